@@ -0,0 +1,244 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "debugging.h"
+#include "mandelbrot.h"
+#include "pool.h"
+#include "render.h"
+#include "fractal.h"
+
+using namespace std;
+
+// renders a fixed catalogue of scenes at every precision, thread count and resolution asked for and prints
+// the throughput as one JSON document on stdout. progress goes to stderr.
+
+struct Scene {
+	const char *name;
+	Location at;
+	int iterations;
+};
+
+static const Scene scenes[] = {
+    {"full", {"-0.75", "0", "3.5"}, 1024},
+    {"seahorse", {"-0.7453", "0.1127", "0.0002"}, 4096},
+    // a minibrot of period 20 on the real axis, 3.6e-17 wide, past the resolution of double
+    {"minibrot", {"-1.99999020291745050043791929152062396601", "0", "1.5e-16"}, 4096},
+    // almost all of it inside the period 3 bulb, only the periodicity check ends those pixels early
+    {"interior", {"-0.1226", "0.7449", "0.25"}, 4096},
+};
+
+struct Result {
+	const char *scene;
+	Precision precision;
+	int width;
+	int height;
+	int threads;
+	double seconds;
+	// iterations of the pixels that escaped. the interior shortcuts skip most of the others, counting them
+	// would measure the shortcuts instead of the kernels.
+	long long iterations;
+};
+
+// the fastest of a few runs, at least min_runs and more while they take less than min_time together
+static double measure(Image &image, const Scene &scene, Precision precision, pool &workers, int nthreads,
+                      int min_runs, double min_time)
+{
+	double best = 1e30, total = 0;
+	for (int run = 0; run < min_runs || total < min_time; ++run) {
+		double t0 = Profiler::get();
+		render_location(image, scene.at, precision, scene.iterations, workers, nthreads);
+		double t = Profiler::get() - t0;
+		best = min(best, t);
+		total += t;
+	}
+	return best;
+}
+
+static long long iterations(const Image &image, int n)
+{
+	long long sum = 0;
+	for (int i = 0; i < image.width * image.height; ++i)
+		if (image.iter[i] >= 0 && image.iter[i] < n)
+			sum += image.iter[i];
+	return sum;
+}
+
+// Fractal::operator++ on a Koch curve, every step has four times the segments of the one before
+static void geometry(int max_depth, vector<pair<size_t, double>> &steps)
+{
+	Fractal f;
+	f.model = {{0, 0}, {1.0f / 3, 0}, {0.5f, 0.2886751f}, {2.0f / 3, 0}, {1, 0}};
+	for (int d = 1; d <= max_depth; ++d) {
+		double t0 = Profiler::get();
+		++f;
+		steps.push_back({f.current_size, Profiler::get() - t0});
+		fprintf(stderr, "geometry depth %d: %zu points %.4fs\n", d, f.current_size, steps.back().second);
+	}
+	f.clear();
+}
+
+// comma separated list of items
+static vector<string> split(const string &s)
+{
+	vector<string> items;
+	istringstream in(s);
+	string item;
+	while (getline(in, item, ','))
+		if (!item.empty())
+			items.push_back(item);
+	return items;
+}
+
+static void usage()
+{
+	fprintf(stderr, "usage: fractal_bench [options]\n"
+	                "  -s scenes      full,seahorse,minibrot,interior\n"
+	                "  -p precisions  all the build has, as named in the job files\n"
+	                "  -t threads     1 and powers of two up to the hardware threads\n"
+	                "  -r sizes       frame sizes, 320x180\n"
+	                "  -g depth       deepest Koch curve of the geometry fractal, 10, 0 skips it\n"
+	                "  -n runs        runs of every case, the fastest counts, 3\n");
+}
+
+int main(int argc, char **argv)
+{
+	vector<const Scene *> chosen;
+	vector<Precision> precisions;
+	vector<int> threads;
+	vector<pair<int, int>> sizes;
+	int geometry_depth = 10;
+	int runs = 3;
+
+	for (int i = 1; i < argc; ++i) {
+		if (i + 1 >= argc || argv[i][0] != '-') {
+			usage();
+			return 2;
+		}
+		const char *a = argv[i], *v = argv[++i];
+		bool ok = true;
+		if (!strcmp(a, "-s")) {
+			for (const string &name : split(v)) {
+				auto s = find_if(begin(scenes), end(scenes), [&](const Scene &s) { return name == s.name; });
+				ok = ok && s != end(scenes);
+				if (ok)
+					chosen.push_back(s);
+			}
+		} else if (!strcmp(a, "-p")) {
+			for (const string &name : split(v)) {
+				Precision p;
+				ok = ok && parse_precision(name, p);
+				precisions.push_back(p);
+			}
+		} else if (!strcmp(a, "-t")) {
+			for (const string &t : split(v)) {
+				threads.push_back(atoi(t.c_str()));
+				ok = ok && threads.back() > 0;
+			}
+		} else if (!strcmp(a, "-r")) {
+			for (const string &r : split(v)) {
+				int w, h;
+				ok = ok && sscanf(r.c_str(), "%dx%d", &w, &h) == 2 && w > 0 && h > 0;
+				sizes.push_back({w, h});
+			}
+		} else if (!strcmp(a, "-g")) {
+			geometry_depth = atoi(v);
+		} else if (!strcmp(a, "-n")) {
+			runs = max(1, atoi(v));
+		} else {
+			ok = false;
+		}
+		if (!ok) {
+			usage();
+			return 2;
+		}
+	}
+
+	const int hardware = max(1, (int)thread::hardware_concurrency());
+	if (chosen.empty())
+		for (const Scene &s : scenes)
+			chosen.push_back(&s);
+	if (precisions.empty())
+		for (int p = 0; p < (LARGE_NUMBERS ? 9 : 2); ++p)
+			precisions.push_back(static_cast<Precision>(p));
+	if (threads.empty()) {
+		for (int t = 1; t < hardware; t *= 2)
+			threads.push_back(t);
+		threads.push_back(hardware);
+	}
+	if (sizes.empty())
+		sizes = {{320, 180}};
+	// the single thread runs are the base of the scaling efficiency
+	if (find(threads.begin(), threads.end(), 1) == threads.end())
+		threads.insert(threads.begin(), 1);
+
+	pool workers;
+	vector<Result> results;
+	for (auto [w, h] : sizes) {
+		vector<uint8_t> buf(size_t(w) * h * 4);
+		vector<int> iter(size_t(w) * h);
+		Image image;
+		image.buf = buf.data();
+		image.buf_size = buf.size();
+		image.iter = iter.data();
+		image.width = w;
+		image.height = h;
+		for (const Scene *scene : chosen) {
+			for (Precision p : precisions) {
+				for (int t : threads) {
+					double s = measure(image, *scene, p, workers, t, runs, 0.2);
+					results.push_back({scene->name, p, w, h, t, s, iterations(image, scene->iterations)});
+					fprintf(stderr, "%s %s %dx%d %d threads: %.4fs\n", scene->name,
+					        precision_names[static_cast<int>(p)], w, h, t, s);
+				}
+			}
+		}
+	}
+
+	vector<pair<size_t, double>> steps;
+	geometry(geometry_depth, steps);
+
+	printf("{\n  \"hardware_threads\": %d,\n  \"simd\": \"%s\",\n  \"large_numbers\": %d,\n", hardware,
+#if defined(__AVX512F__)
+	       "avx512",
+#elif defined(__AVX2__)
+	       "avx2",
+#else
+	       "none",
+#endif
+	       LARGE_NUMBERS);
+	printf("  \"mandelbrot\": [\n");
+	for (size_t i = 0; i < results.size(); ++i) {
+		const Result &r = results[i];
+		// the single thread run of the same case
+		double base = r.seconds * r.threads;
+		for (const Result &o : results)
+			if (o.threads == 1 && o.scene == r.scene && o.precision == r.precision && o.width == r.width &&
+			    o.height == r.height)
+				base = o.seconds;
+		const double pixels = double(r.width) * r.height;
+		printf("    {\"scene\": \"%s\", \"precision\": \"%s\", \"width\": %d, \"height\": %d, \"threads\": %d, "
+		       "\"seconds\": %.6f, \"pixels_per_s\": %.0f, \"miter_per_s\": %.3f, \"efficiency\": %.3f}%s\n",
+		       r.scene, precision_names[static_cast<int>(r.precision)], r.width, r.height, r.threads, r.seconds,
+		       pixels / r.seconds, r.iterations / r.seconds * 1e-6, base / (r.seconds * r.threads),
+		       i + 1 < results.size() ? "," : "");
+	}
+	printf("  ],\n  \"geometry\": [\n");
+	for (size_t i = 0; i < steps.size(); ++i)
+		printf("    {\"depth\": %zu, \"points\": %zu, \"seconds\": %.6f, \"points_per_s\": %.0f}%s\n", i + 1,
+		       steps[i].first, steps[i].second, steps[i].first / max(steps[i].second, 1e-9),
+		       i + 1 < steps.size() ? "," : "");
+	printf("  ],\n  \"sections\": [\n");
+	auto totals = Profiler::totals();
+	size_t k = 0;
+	for (const auto &[name, total] : totals)
+		printf("    {\"name\": \"%s\", \"count\": %lld, \"seconds\": %.6f}%s\n", name.c_str(), total.count,
+		       total.seconds, ++k < totals.size() ? "," : "");
+	printf("  ]\n}\n");
+	return 0;
+}
@@ -0,0 +1,73 @@
+#include <math.h>
+#include <stdio.h>
+#include <vector>
+
+#include "pool.h"
+#include "render.h"
+
+using namespace std;
+
+// the distance estimate of deep views from the double-double and quad-double lanes against the scalar fixed
+// point kernels. dz/dc of these views is far beyond the range of float.
+
+struct Case {
+	Precision lanes;
+	Precision reference;
+	Location at;
+};
+
+// c = i is a Misiurewicz point on the boundary, the pixels around it escape at every depth
+static const Case cases[] = {
+    {Precision::DoubleDouble, Precision::Fixed128, {"0", "1", "1e-26"}},
+    {Precision::QuadDouble, Precision::Fixed256, {"0", "1", "1e-45"}},
+};
+
+constexpr int frame_size = 64;
+constexpr int iterations = 4000;
+
+struct Frame {
+	vector<int> iter = vector<int>(frame_size * frame_size);
+	vector<float> r2 = vector<float>(frame_size * frame_size);
+	vector<float> distance = vector<float>(frame_size * frame_size);
+};
+
+static bool render_frame(Frame &f, const Location &at, Precision precision, pool &workers)
+{
+	Image image;
+	image.iter = f.iter.data();
+	image.r2 = f.r2.data();
+	image.distance = f.distance.data();
+	image.width = frame_size;
+	image.height = frame_size;
+	return render_location(image, at, precision, iterations, workers, 1);
+}
+
+int main()
+{
+	pool workers;
+	int failures = 0;
+	for (const Case &c : cases) {
+		const char *name = precision_names[static_cast<int>(c.lanes)];
+		Frame lanes, reference;
+		if (!render_frame(lanes, c.at, c.lanes, workers) ||
+		    !render_frame(reference, c.at, c.reference, workers)) {
+			printf("%s: the location does not parse\n", name);
+			failures++;
+			continue;
+		}
+		int escaped = 0, wrong = 0;
+		for (int i = 0; i < frame_size * frame_size; ++i) {
+			if (reference.iter[i] >= iterations)
+				continue;
+			escaped++;
+			// pixels much closer to the set than their size depend on the rounding of either type
+			const float a = lanes.distance[i], b = reference.distance[i];
+			if (!(a > 0) || !isfinite(a) || (b > 0.1f && fabsf(a - b) > 1e-2f * b))
+				wrong++;
+		}
+		printf("%s at %s: %d of %d escaped pixels differ\n", name, c.at.extent.c_str(), wrong, escaped);
+		if (wrong || escaped < frame_size * frame_size / 2)
+			failures++;
+	}
+	return failures ? 1 : 0;
+}
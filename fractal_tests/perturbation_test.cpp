@@ -0,0 +1,63 @@
+#include <stdio.h>
+#include <vector>
+
+#include "pool.h"
+#include "render.h"
+
+using namespace std;
+
+// perturbation against the scalar fixed point kernel, on views float128 resolves and on deeper ones where the
+// reference orbit goes on in fixed256
+
+// c = i is a Misiurewicz point on the boundary, the pixels around it escape at every depth
+static const Location cases[] = {
+    {"0", "1", "1e-26"},
+    {"0", "1", "1e-45"},
+    {"0", "1", "1e-60"},
+};
+
+constexpr int frame_size = 64;
+constexpr int iterations = 4000;
+// pixels next to the boundary may escape an iteration apart, the glitch detection of perturbation only bounds the
+// error
+constexpr int tolerated = frame_size * frame_size / 100;
+
+struct Frame {
+	vector<int> iter = vector<int>(frame_size * frame_size);
+	vector<float> r2 = vector<float>(frame_size * frame_size);
+};
+
+static bool render_frame(Frame &f, const Location &at, Precision precision, pool &workers)
+{
+	Image image;
+	image.iter = f.iter.data();
+	image.r2 = f.r2.data();
+	image.width = frame_size;
+	image.height = frame_size;
+	return render_location(image, at, precision, iterations, workers, 1);
+}
+
+int main()
+{
+	pool workers;
+	int failures = 0;
+	for (const Location &at : cases) {
+		Frame perturbed, reference;
+		if (!render_frame(perturbed, at, Precision::Perturbation, workers) ||
+		    !render_frame(reference, at, Precision::Fixed256, workers)) {
+			printf("%s: the location does not parse\n", at.extent.c_str());
+			failures++;
+			continue;
+		}
+		int escaped = 0, wrong = 0;
+		for (int i = 0; i < frame_size * frame_size; ++i) {
+			escaped += reference.iter[i] < iterations;
+			wrong += perturbed.iter[i] != reference.iter[i];
+		}
+		printf("perturbation at %s: %d of %d pixels differ, %d escaped\n", at.extent.c_str(), wrong,
+		       frame_size * frame_size, escaped);
+		if (wrong > tolerated || escaped < frame_size * frame_size / 2)
+			failures++;
+	}
+	return failures ? 1 : 0;
+}
@@ -28,7 +28,7 @@ struct Fractal
 	std::pair<Point, int> nearest(const Point &p) const;
 
 	std::vector<Point> model;
-	Point *current;
-	size_t current_size;
+	Point *current = nullptr;
+	size_t current_size = 0;
 	int iterations = 0;
 };
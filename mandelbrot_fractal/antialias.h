@@ -0,0 +1,231 @@
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "debugging.h"
+#include "mandelbrot.h"
+#include "perturbation.h"
+#include "pool.h"
+#include "coloring.h"
+#include "render.h"
+
+// adaptive anti-aliasing of a colored frame. a pixel whose color differs from a neighbor's by more than
+// aa_threshold in a channel, or that is inside the set while the neighbor is not, takes the average color of
+// samples x samples subsamples over its area. the rest of the frame keeps its single sample, so the cost
+// follows the length of the edges instead of the area.
+
+// largest channel difference to a neighbor a pixel keeps its one sample with
+constexpr int aa_threshold = 24;
+constexpr int aa_max_samples = 8;
+
+// marks the pixels to refine in edges and returns how many there are. every pixel only marks itself, the
+// bands never write each other's rows. with distance estimates an escaping pixel within a pixel of the set is
+// an edge too, a filament through it may have missed every neighbor's sample.
+inline long long find_edges(const Image &image, int n, std::vector<uint8_t> &edges, pool &workers, int nthreads)
+{
+	const int w = image.width, h = image.height;
+	edges.assign(size_t(w) * h, 0);
+	std::atomic<long long> count{0};
+	parallel_bands(workers, h, nthreads, [&image, &edges, &count, n, w, h](int y0, int y1, int) {
+		long long marked = 0;
+		for (int y = y0; y < y1; ++y) {
+			for (int x = 0; x < w; ++x) {
+				const size_t i = size_t(y) * w + x;
+				const uint8_t *p = image.buf + i * 4;
+				const bool inside = image.iter[i] == n;
+				auto differs = [&image, p, inside, n](size_t j) {
+					const uint8_t *q = image.buf + j * 4;
+					return (image.iter[j] == n) != inside || abs(p[0] - q[0]) > aa_threshold ||
+					       abs(p[1] - q[1]) > aa_threshold || abs(p[2] - q[2]) > aa_threshold;
+				};
+				const bool near = image.distance && !inside && image.distance[i] < 1;
+				const bool edge = near || (x > 0 && differs(i - 1)) || (x + 1 < w && differs(i + 1)) ||
+				                  (y > 0 && differs(i - w)) || (y + 1 < h && differs(i + w));
+				edges[i] = edge;
+				marked += edge;
+			}
+		}
+		count += marked;
+	});
+	return count;
+}
+
+// a fixed pseudo random number of a pixel, the same in every run so exports are reproducible
+inline uint32_t pixel_hash(uint32_t x, uint32_t y)
+{
+	uint32_t h = x * 0x9e3779b1u ^ (y + 0x7f4a7c15u) * 0x85ebca77u;
+	h ^= h >> 15;
+	h *= 0x2c1b3c6du;
+	h ^= h >> 12;
+	h *= 0x297a2d39u;
+	return h ^ h >> 15;
+}
+
+// refines the edge pixels of image, which holds r computed and colored with n iterations. the subsamples of
+// a pixel form a grid over its area centered on its own sample, shifted by a random fraction of a subsample
+// per pixel so neighbors do not alias alike. the edge pixels of every tile are one work item. ref iterates the
+// samples of a perturbed frame, hist colors them when the frame was equalized. the samples of other frames
+// are computed with formula. returns the pixels refined.
+template <typename T>
+long long antialias(Image &image, const Rect<T> &r, int n, Reference<T> *ref, int samples, const Palette &palette,
+                    const histogram &hist, pool &workers, int nthreads, const FormulaParams &formula = FormulaParams())
+{
+	PROF;
+	samples = std::min(samples, aa_max_samples);
+	std::vector<uint8_t> edges;
+	const long long count = samples > 1 ? find_edges(image, n, edges, workers, nthreads) : 0;
+	if (!count)
+		return 0;
+
+	std::vector<Tile> tiles;
+	for (const Tile &t : make_tiles(image.width, image.height, render_tile_size, false)) {
+		bool any = false;
+		for (int y = t.y0; y < t.y1 && !any; ++y)
+			for (int x = t.x0; x < t.x1 && !any; ++x)
+				any = edges[size_t(y) * image.width + x];
+		if (any)
+			tiles.push_back(t);
+	}
+
+	const T scalex = (r.x1 - r.x0) / image.width;
+	const T scaley = (r.y1 - r.y0) / image.height;
+	workers.start(nthreads, tiles, [&](const Tile &t) {
+		const int s = samples, m = s * s;
+		tile_span span(image, t, t.frame, n, "antialias");
+		span.counted = false;
+
+		std::vector<int> pixels;
+		for (int y = t.y0; y < t.y1; ++y)
+			for (int x = t.x0; x < t.x1; ++x)
+				if (edges[size_t(y) * image.width + x])
+					pixels.push_back(y * image.width + x);
+		const int count = (int)pixels.size();
+
+		// the samples of the k-th edge pixel go to row k
+		std::vector<uint8_t> buf(size_t(count) * m * 4);
+		std::vector<int> iter(size_t(count) * m);
+		std::vector<float> r2(size_t(count) * m);
+		std::vector<float> distance(image.distance ? size_t(count) * m : 0);
+		Image samples_image;
+		samples_image.buf = buf.data();
+		samples_image.buf_size = buf.size();
+		samples_image.iter = iter.data();
+		samples_image.r2 = r2.data();
+		samples_image.distance = image.distance ? distance.data() : nullptr;
+		samples_image.width = m;
+		samples_image.height = count;
+
+		// the first subsample of a pixel in pixels from the pixel's own sample
+		auto jitter = [s](int x, int y, double &jx, double &jy) {
+			const uint32_t hash = pixel_hash(x, y);
+			jx = ((hash & 0xffff) / 65536.0 - s / 2.0) / s;
+			jy = ((hash >> 16) / 65536.0 - s / 2.0) / s;
+		};
+
+#if LARGE_NUMBERS
+		if constexpr (has_reference<T>) {
+			// one batch for the tile, its glitched samples share the extra references
+			if (ref) {
+				std::vector<double> px(size_t(count) * m), py(size_t(count) * m);
+				for (int k = 0; k < count; ++k) {
+					const int x = pixels[k] % image.width, y = pixels[k] / image.width;
+					double jx, jy;
+					jitter(x, y, jx, jy);
+					for (int j = 0; j < m; ++j) {
+						px[k * m + j] = x + jx + double(j % s) / s;
+						py[k * m + j] = y + jy + double(j / s) / s;
+					}
+				}
+				span.add(perturbation_points(samples_image, px.data(), py.data(), count * m, image.width,
+				                             image.height, *ref));
+			}
+		}
+#endif
+		if (!ref) {
+			for (int k = 0; k < count; ++k) {
+				const int x = pixels[k] % image.width, y = pixels[k] / image.width;
+				double jx, jy;
+				jitter(x, y, jx, jy);
+				// the s x s grid over the pixel is an image of its own
+				Image sub;
+				sub.iter = iter.data() + k * m;
+				sub.r2 = r2.data() + k * m;
+				sub.distance = image.distance ? distance.data() + k * m : nullptr;
+				sub.width = s;
+				sub.height = s;
+				Rect<T> cell;
+				cell.x0 = scalex * T(x) + scalex * T(jx) + r.x0;
+				cell.x1 = cell.x0 + scalex;
+				cell.y0 = scaley * T(y) + scaley * T(jy) + r.y0;
+				cell.y1 = cell.y0 + scaley;
+				with_formula(formula, [&](const auto &step) {
+					span.add(mandelbrot(sub, 0, 0, s, s, cell, n, nullptr, 1, 1, step));
+				});
+				// in pixels of the frame, not of the grid
+				if (sub.distance)
+					for (int j = 0; j < m; ++j)
+						sub.distance[j] /= s;
+			}
+		}
+
+		if (palette.coloring != Coloring::Histogram || !hist.shade(samples_image, n, palette))
+			colorize(samples_image, 0, 0, m, count, n, palette);
+		for (int k = 0; k < count; ++k) {
+			unsigned sum[4] = {0, 0, 0, 0};
+			const uint8_t *row = buf.data() + size_t(k) * m * 4;
+			for (int j = 0; j < m * 4; ++j)
+				sum[j & 3] += row[j];
+			uint8_t *dst = image.buf + size_t(pixels[k]) * 4;
+			for (int c = 0; c < 4; ++c)
+				dst[c] = uint8_t((sum[c] + m / 2) / m);
+		}
+	});
+	workers.wait();
+	return count;
+}
+
+// antialias() of a frame render_location() computed and colorize_frame() colored, false when the location
+// does not parse. a perturbed frame of the mandelbrot formula gets a reference orbit of its own.
+inline bool antialias_location(Image &image, const Location &at, Precision precision, int n, int samples,
+                               const Palette &palette, const histogram &hist, pool &workers, int nthreads,
+                               long long &refined, const FormulaParams &formula = FormulaParams())
+{
+	auto run = [&](auto zero, bool perturbed = false) {
+		using T = decltype(zero);
+		Rect<T> r;
+		if (!location_rect(at, image.width, image.height, r))
+			return false;
+		std::unique_ptr<Reference<T>> ref;
+		if (perturbed && formula.formula == Formula::Mandelbrot)
+			ref = std::make_unique<Reference<T>>(r, n);
+		refined = antialias(image, r, n, ref.get(), samples, palette, hist, workers, nthreads, formula);
+		return true;
+	};
+	switch (precision) {
+	case Precision::Single:
+		return run(float());
+	case Precision::Double:
+		return run(double());
+#if LARGE_NUMBERS
+	case Precision::Large:
+		return run(float128());
+	case Precision::Fixed128:
+		return run(fixed128());
+	case Precision::Fixed192:
+		return run(fixed192());
+	case Precision::Fixed256:
+		return run(fixed256());
+	case Precision::DoubleDouble:
+		return run(dd_real());
+	case Precision::QuadDouble:
+		return run(qd_real());
+	case Precision::Perturbation:
+		if (deep_locations(&image, &at, 1))
+			return run(fixed256(), true);
+		return run(float128(), true);
+#endif
+	}
+	return false;
+}
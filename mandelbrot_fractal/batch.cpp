@@ -0,0 +1,286 @@
+#include <stdio.h>
+#include <string.h>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "debugging.h"
+#include "mandelbrot.h"
+#include "pool.h"
+#include "palette.h"
+#include "coloring.h"
+#include "render.h"
+#include "antialias.h"
+#include "image_file.h"
+#include "tile_pyramid.h"
+
+using namespace std;
+
+// renders the views of a job file to image files without a window. one job per line, key=value pairs
+// separated by spaces, empty lines and lines starting with # are skipped:
+//
+//   output=seahorse.png width=1920 height=1080 precision=double iterations=4096 x=-0.7453 y=0.1127
+//   extent=0.0002 coloring=histogram offset=0 aa=4
+//
+// x and y are the center and extent the width of the real axis shown, all exact decimals. aa=k gives the
+// pixels on edges k x k samples, see antialias(). formula=julia:-0.8,0.156 or formula=multibrot:4 picks
+// another formula than the mandelbrot set, see parse_formula(). level=L column=c row=r instead of x, y and
+// extent places the lower left pixel on pixel c, r of level L of the tile pyramid, see tile_pyramid.h, such
+// views are assembled from the cached tiles with -C. the output is PNG for .png files and PPM otherwise.
+
+struct Job {
+	string output;
+	int width = 1920;
+	int height = 1080;
+	Precision precision = Precision::Double;
+	int iterations = 1024;
+	Location at;
+	Coloring coloring = Coloring::Smooth;
+	int offset = 0;
+	// subsamples per axis of the edge pixels, 1 for none
+	int aa = 1;
+	FormulaParams formula;
+	// at is the location of view when level= is given
+	bool pyramid = false;
+	PyramidView view;
+};
+
+static bool parse_int(const string &s, int lo, int hi, int &v)
+{
+	char *end;
+	long a = strtol(s.c_str(), &end, 10);
+	if (s.empty() || *end || a < lo || a > hi)
+		return false;
+	v = (int)a;
+	return true;
+}
+
+static bool parse_long(const string &s, long long &v)
+{
+	char *end;
+	v = strtoll(s.c_str(), &end, 10);
+	return !s.empty() && !*end;
+}
+
+// the job of a line, error names the first bad pair
+static bool parse_job(const string &line, Job &job, string &error)
+{
+	istringstream in(line);
+	string pair;
+	while (in >> pair) {
+		size_t eq = pair.find('=');
+		if (eq == string::npos) {
+			error = "expected key=value: " + pair;
+			return false;
+		}
+		const string key = pair.substr(0, eq);
+		const string value = pair.substr(eq + 1);
+		bool ok = true;
+		if (key == "output") {
+			job.output = value;
+		} else if (key == "width") {
+			ok = parse_int(value, 1, 1 << 16, job.width);
+		} else if (key == "height") {
+			ok = parse_int(value, 1, 1 << 16, job.height);
+		} else if (key == "iterations") {
+			ok = parse_int(value, 1, 1 << 30, job.iterations);
+		} else if (key == "precision") {
+			ok = parse_precision(value, job.precision);
+		} else if (key == "x") {
+			job.at.x = value;
+		} else if (key == "y") {
+			job.at.y = value;
+		} else if (key == "extent") {
+			job.at.extent = value;
+		} else if (key == "coloring") {
+			if (value == "bands")
+				job.coloring = Coloring::Bands;
+			else if (value == "smooth")
+				job.coloring = Coloring::Smooth;
+			else if (value == "histogram")
+				job.coloring = Coloring::Histogram;
+			else if (value == "distance")
+				job.coloring = Coloring::Distance;
+			else
+				ok = false;
+		} else if (key == "offset") {
+			ok = parse_int(value, 0, (int)palette_size - 1, job.offset);
+		} else if (key == "aa") {
+			ok = parse_int(value, 1, aa_max_samples, job.aa);
+		} else if (key == "formula") {
+			ok = parse_formula(value, job.formula);
+		} else if (key == "level") {
+			ok = parse_int(value, 0, pyramid_max_level, job.view.level);
+			job.pyramid = true;
+		} else if (key == "column") {
+			ok = parse_long(value, job.view.column);
+		} else if (key == "row") {
+			ok = parse_long(value, job.view.row);
+		} else {
+			error = "unknown key " + key;
+			return false;
+		}
+		if (!ok) {
+			error = "bad value of " + key + ": " + value;
+			return false;
+		}
+	}
+	if (job.output.empty()) {
+		error = "no output";
+		return false;
+	}
+	if (job.pyramid) {
+		if (!pyramid_valid(job.view, job.width, job.height)) {
+			error = "view outside the pyramid";
+			return false;
+		}
+		job.at = pyramid_location(job.view, job.width, job.height);
+	}
+	return true;
+}
+
+static void usage()
+{
+	fprintf(stderr, "usage: fractal_batch [-t threads] [-T trace.json] [-C tiles] [-M megabytes] jobs\n"
+	                "renders every line of the job file, - reads the jobs from stdin\n"
+	                "-T writes the phases and tiles of the run as a Chrome trace\n"
+	                "-C keeps the tiles of pyramid views in the directory tiles and reuses them\n"
+	                "-M tiles kept in memory, 256 megabytes\n");
+}
+
+int main(int argc, char **argv)
+{
+	int nthreads = (int)thread::hardware_concurrency();
+	const char *path = nullptr;
+	const char *trace_path = nullptr;
+	const char *tiles_path = nullptr;
+	int megabytes = 256;
+	for (int i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i], "-t") && i + 1 < argc && parse_int(argv[i + 1], 1, 1024, nthreads))
+			i++;
+		else if (!strcmp(argv[i], "-C") && i + 1 < argc)
+			tiles_path = argv[++i];
+		else if (!strcmp(argv[i], "-M") && i + 1 < argc && parse_int(argv[i + 1], 0, 1 << 20, megabytes))
+			i++;
+		else if (!strcmp(argv[i], "-T") && i + 1 < argc)
+			trace_path = argv[++i];
+		// one job file, - for stdin. a second one is an error like any unknown argument
+		else if (!path && (argv[i][0] != '-' || !strcmp(argv[i], "-")))
+			path = argv[i];
+		else
+			return usage(), 2;
+	}
+	if (!path)
+		return usage(), 2;
+	trace::enable(trace_path != nullptr);
+
+	ifstream file;
+	if (strcmp(path, "-")) {
+		file.open(path);
+		if (!file) {
+			fprintf(stderr, "can't open %s\n", path);
+			return 1;
+		}
+	}
+	istream &in = strcmp(path, "-") ? file : cin;
+
+	// one pool for all jobs, its threads stay up between them
+	pool workers;
+	unique_ptr<tile_cache> tiles;
+	if (tiles_path)
+		tiles = make_unique<tile_cache>(tiles_path, size_t(megabytes) << 20);
+	Palette palette;
+	histogram hist;
+	Image image;
+	vector<uint8_t> buf;
+	vector<int> iter;
+	vector<float> r2;
+	vector<float> distance;
+
+	int failed = 0, done = 0;
+	const double begin = Profiler::get();
+	string line;
+	for (int number = 1; getline(in, line); ++number) {
+		size_t first = line.find_first_not_of(" \t\r");
+		if (first == string::npos || line[first] == '#')
+			continue;
+
+		Job job;
+		string error;
+		if (!parse_job(line, job, error)) {
+			fprintf(stderr, "line %d: %s\n", number, error.c_str());
+			failed++;
+			continue;
+		}
+
+		const size_t pixels = size_t(job.width) * job.height;
+		buf.resize(pixels * 4);
+		iter.resize(pixels);
+		r2.resize(pixels);
+		image.buf = buf.data();
+		image.buf_size = buf.size();
+		image.iter = iter.data();
+		image.r2 = r2.data();
+		// the derivative the estimate takes is only iterated for the coloring that shows it, and only the
+		// mandelbrot formula has it
+		const bool estimate = job.coloring == Coloring::Distance && job.formula.formula == Formula::Mandelbrot;
+		if (estimate)
+			distance.resize(pixels);
+		image.distance = estimate ? distance.data() : nullptr;
+		image.width = job.width;
+		image.height = job.height;
+
+		double t0 = Profiler::get();
+		// the tiles hold no distances
+		const bool cached = tiles && job.pyramid && !estimate;
+		const long long computed = tiles ? tiles->misses.load() : 0;
+		const bool rendered = cached ? render_pyramid(image, job.view, job.precision, job.iterations,
+		                                              job.formula, *tiles, workers, nthreads)
+		                             : render_location(image, job.at, job.precision, job.iterations, workers,
+		                                               nthreads, nullptr, job.formula);
+		if (!rendered) {
+			fprintf(stderr, "line %d: bad location\n", number);
+			failed++;
+			continue;
+		}
+		double t1 = Profiler::get();
+		palette.coloring = job.coloring;
+		palette.offset = job.offset;
+		colorize_frame(image, job.iterations, palette, hist, workers, nthreads);
+		double t2 = Profiler::get();
+		long long refined = 0;
+		if (job.aa > 1)
+			antialias_location(image, job.at, job.precision, job.iterations, job.aa, palette, hist, workers,
+			                   nthreads, refined, job.formula);
+		double t_aa = Profiler::get();
+		if (!write_image(image, job.output)) {
+			fprintf(stderr, "line %d: can't write %s\n", number, job.output.c_str());
+			failed++;
+			continue;
+		}
+		double t3 = Profiler::get();
+
+		printf("%s %dx%d %s n=%d: render %.3fs, color %.3fs, write %.3fs, %.2f Mpixel/s", job.output.c_str(),
+		       job.width, job.height, precision_names[static_cast<int>(job.precision)], job.iterations, t1 - t0,
+		       t2 - t1, t3 - t_aa, pixels / (t1 - t0) * 1e-6);
+		if (job.aa > 1)
+			printf(", aa %.3fs for %lld edge pixels (%.1f%%)", t_aa - t2, refined, refined * 100.0 / pixels);
+		if (cached)
+			printf(", %lld tiles computed", tiles->misses - computed);
+		printf("\n");
+		fflush(stdout);
+		done++;
+	}
+	printf("%d jobs in %.3fs, %d failed\n", done, Profiler::get() - begin, failed);
+	if (tiles)
+		printf("tiles: %lld from memory, %lld from disk, %lld computed\n", tiles->memory_hits.load(),
+		       tiles->disk_hits.load(), tiles->misses.load());
+	if (trace_path && !trace::write_chrome(trace_path)) {
+		fprintf(stderr, "can't write %s\n", trace_path);
+		return 1;
+	}
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,163 @@
+#pragma once
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+#include "debugging.h"
+#include "mandelbrot.h"
+#include "pool.h"
+
+// coloring of the whole frame once it is done. the stages split the frame in horizontal bands, one per
+// thread, so recoloring stays cheap at 8K.
+
+// runs f(begin, end, band) on nthreads bands of [0, count) and waits for them. the bands are tiles of workers,
+// the calling thread takes the last one. not from a tile of workers, nor while another thread submits to it.
+template <typename F> void parallel_bands(pool &workers, int count, int nthreads, F &&f)
+{
+	nthreads = std::max(1, std::min(nthreads, count));
+	if (nthreads == 1) {
+		f(0, count, 0);
+		return;
+	}
+	auto begin = [count, nthreads](int b) { return int((long long)count * b / nthreads); };
+	std::vector<Tile> bands;
+	for (int b = 0; b + 1 < nthreads; ++b) {
+		Tile t = {begin(b), 0, begin(b + 1), 1};
+		t.frame = b;
+		bands.push_back(t);
+	}
+	auto batch = workers.submit(nthreads, bands, [&f](const Tile &t) { f(t.x0, t.x1, t.frame); });
+	f(begin(nthreads - 1), count, nthreads - 1);
+	workers.wait(*batch);
+}
+
+// the histogram has a bin for every iteration below 2^(histogram_bits + 1) and 2^histogram_bits bins for every
+// octave above, the bins of every thread stay small whatever max_iterations is
+constexpr int histogram_bits = 12;
+
+// histogram equalization: an escaping pixel takes the gradient at the share of escaping pixels that
+// escaped before it, so the colors spread evenly over the frame whatever max_iterations is.
+class histogram {
+	public:
+	void equalize(Image &image, int n, const Palette &palette, pool &workers, int nthreads)
+	{
+		nthreads = std::max(1, std::min(nthreads, image.height));
+		bands.resize(nthreads);
+		const int bins = bin(n - 1) + 1;
+
+		// every band counts its rows in its own histogram
+		parallel_bands(workers, image.height, nthreads, [this, &image, n, bins](int y0, int y1, int b) {
+			std::vector<uint32_t> &h = bands[b];
+			h.assign(bins, 0);
+			const int *iter = image.iter + y0 * image.width;
+			const int *end = image.iter + y1 * image.width;
+			for (; iter < end; ++iter)
+				if (*iter >= 0 && *iter < n)
+					h[bin(*iter)]++;
+		});
+
+		// and the bins of all bands are summed in parallel
+		counts.resize(bins);
+		parallel_bands(workers, bins, nthreads, [this](int i0, int i1, int) {
+			std::copy(bands[0].begin() + i0, bands[0].begin() + i1, counts.begin() + i0);
+			for (size_t b = 1; b < bands.size(); ++b)
+				for (int i = i0; i < i1; ++i)
+					counts[i] += bands[b][i];
+		});
+
+		// share of the escaping pixels below every bin, the last entry is 1
+		cdf.resize(bins + 1);
+		long long total = 0;
+		for (int i = 0; i < bins; ++i)
+			total += counts[i];
+		const double scale = total ? 1.0 / total : 0.0;
+		long long below = 0;
+		for (int i = 0; i < bins; ++i) {
+			cdf[i] = float(below * scale);
+			below += counts[i];
+		}
+		cdf[bins] = 1;
+		equalized = n;
+
+		parallel_bands(workers, image.height, nthreads, [this, &image, n, &palette](int y0, int y1, int) {
+			colorize_equalized(image, y0, y1, n, palette);
+		});
+	}
+
+	// colors image with the shares of the frame equalized last, for extra samples of that frame. false before
+	// a frame with n iterations was equalized.
+	bool shade(Image &image, int n, const Palette &palette) const
+	{
+		if (equalized != n)
+			return false;
+		colorize_equalized(image, 0, image.height, n, palette);
+		return true;
+	}
+
+	private:
+	// bin of iteration i >= 0, see histogram_bits
+	static int bin(int i)
+	{
+		constexpr int octave = 1 << histogram_bits;
+		if (i < 2 * octave)
+			return i;
+		const int shift = 31 - __builtin_clz(i) - histogram_bits;
+		return shift * octave + (i >> shift);
+	}
+
+	// first iteration of bin b
+	static long long bin_start(int b)
+	{
+		constexpr int octave = 1 << histogram_bits;
+		if (b < 2 * octave)
+			return b;
+		const int shift = b / octave - 1;
+		return (long long)(b % octave + octave) << shift;
+	}
+
+	// between the shares of its bin and the next one by where the iteration and its escape fraction lie in
+	// the bin. the bins below 2^(histogram_bits + 1) hold one iteration, the fraction alone places it.
+	void colorize_equalized(Image &image, int top, int bottom, int n, const Palette &palette) const
+	{
+		const float scale = palette.histogram_turns * gradient_size;
+		const float *share = cdf.data();
+		int pos[shade_chunk];
+		for (int y = top; y < bottom; ++y) {
+			const int *iter = image.iter + y * image.width;
+			const float *r2 = image.r2 ? image.r2 + y * image.width : nullptr;
+			uint32_t *row = reinterpret_cast<uint32_t *>(image.buf) + y * image.width;
+			for (int x0 = 0; x0 < image.width; x0 += shade_chunk) {
+				const int count = std::min(shade_chunk, image.width - x0);
+				// the shares of pixels that stay black are never used, only read in bounds
+				for (int x = 0; x < count; ++x) {
+					const int i = std::min(std::max(iter[x0 + x], 0), n - 1);
+					const int b = bin(i);
+					const long long start = bin_start(b);
+					const float f = r2 ? escape_fraction(r2[x0 + x]) : 0.0f;
+					const float t = (float(i - start) + f) / float(bin_start(b + 1) - start);
+					pos[x] = int((share[b] + t * (share[b + 1] - share[b])) * scale);
+				}
+				shade_gradient(iter + x0, pos, row + x0, count, n, palette);
+			}
+		}
+	}
+
+	std::vector<std::vector<uint32_t>> bands;
+	std::vector<uint32_t> counts;
+	std::vector<float> cdf;
+	// max_iterations of the frame the shares are of
+	int equalized = -1;
+};
+
+// colors the whole frame with the palette's coloring
+inline void colorize_frame(Image &image, int n, const Palette &palette, histogram &hist, pool &workers,
+                           int nthreads)
+{
+	PROF;
+	if (palette.coloring == Coloring::Histogram && n > 0) {
+		hist.equalize(image, n, palette, workers, nthreads);
+		return;
+	}
+	parallel_bands(workers, image.height, nthreads, [&image, n, &palette](int y0, int y1, int) {
+		colorize(image, 0, y0, image.width, y1, n, palette);
+	});
+}
@@ -2,10 +2,19 @@
 #ifdef WIN32
 #include <windows.h>
 #else
-#include <sys/time.h>
+#include <time.h>
 #endif
 
+#include <stdint.h>
+#include <stdio.h>
+#include <algorithm>
 #include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
 
 struct progress_info
 {
@@ -14,66 +23,255 @@ struct progress_info
 	double execution_time_sec = 0;
 };
 
+// nanoseconds of the monotonic clock, gettimeofday jumps with the wall clock and only has microseconds
+inline uint64_t monotonic_ns()
+{
+#ifdef WIN32
+	static const int64_t freq = [] {
+		LARGE_INTEGER f;
+		QueryPerformanceFrequency(&f);
+		return f.QuadPart;
+	}();
+	LARGE_INTEGER i;
+	QueryPerformanceCounter(&i);
+	return uint64_t(i.QuadPart / freq) * 1000000000 + uint64_t(i.QuadPart % freq) * 1000000000 / freq;
+#else
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return uint64_t(ts.tv_sec) * 1000 * 1000 * 1000 + ts.tv_nsec;
+#endif
+}
+
+// tracing of the render threads. every thread writes its spans to a ring of its own without locks, the
+// reader copies a ring and drops what the writer overwrote meanwhile. off by default, then a span costs one
+// load. the PROF sections are the phases, render loops add a span per tile.
+
+struct trace_span {
+	// a string literal
+	const char *name = nullptr;
+	uint64_t begin = 0;
+	uint64_t end = 0;
+	// frame of a tile span, -1 for the phases
+	long long frame = -1;
+	int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+	// iterations the kernels ran for the tile and its pixels that escaped or are inside the set
+	long long iterations = 0;
+	int escaped = 0;
+	int interior = 0;
+};
+
+// spans kept per thread, a power of two
+constexpr int trace_ring_size = 1 << 13;
+
+// a span of a ring, written as number-th span of its thread. number is 0 while the span is being written.
+struct trace_slot {
+	std::atomic<uint64_t> number{0};
+	trace_span span;
+};
+
+struct trace_ring {
+	int thread = 0;
+	// spans ever written, the last trace_ring_size of them are in slots
+	std::atomic<uint64_t> head{0};
+	// spans before this one were cleared
+	std::atomic<uint64_t> tail{0};
+	trace_slot slots[trace_ring_size];
+};
+
+class trace {
+	public:
+	static bool enabled() { return on().load(std::memory_order_relaxed); }
+	static void enable(bool b) { on() = b; }
+
+	// only the thread itself writes to its ring
+	static void record(const trace_span &s)
+	{
+		trace_ring &r = ring();
+		const uint64_t h = r.head.load(std::memory_order_relaxed);
+		trace_slot &slot = r.slots[h & (trace_ring_size - 1)];
+		slot.number.store(0, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		slot.span = s;
+		slot.number.store(h + 1, std::memory_order_release);
+		r.head.store(h + 1, std::memory_order_release);
+	}
+
+	// the spans in the rings by thread, oldest first
+	static std::vector<std::pair<int, trace_span>> collect()
+	{
+		std::vector<std::pair<int, trace_span>> all;
+		std::lock_guard<std::mutex> lock(rings_lock());
+		for (auto &r : rings()) {
+			const uint64_t head = r->head.load(std::memory_order_acquire);
+			const uint64_t oldest = head > trace_ring_size ? head - trace_ring_size : 0;
+			for (uint64_t i = std::max(r->tail.load(), oldest); i < head; ++i) {
+				const trace_slot &slot = r->slots[i & (trace_ring_size - 1)];
+				const uint64_t before = slot.number.load(std::memory_order_acquire);
+				const trace_span s = slot.span;
+				std::atomic_thread_fence(std::memory_order_acquire);
+				// the writer may have wrapped around onto the slot before or while it was copied
+				if (before == i + 1 && slot.number.load(std::memory_order_relaxed) == i + 1)
+					all.push_back({r->thread, s});
+			}
+		}
+		return all;
+	}
+
+	static void clear()
+	{
+		std::lock_guard<std::mutex> lock(rings_lock());
+		for (auto &r : rings())
+			r->tail = r->head.load();
+	}
+
+	// the spans as Chrome trace events for chrome://tracing or Perfetto, false when the file can't be written
+	static bool write_chrome(const char *path)
+	{
+		FILE *f = fopen(path, "w");
+		if (!f)
+			return false;
+		auto spans = collect();
+		uint64_t origin = UINT64_MAX;
+		for (auto &[thread, s] : spans)
+			origin = std::min(origin, s.begin);
+		fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+		const char *sep = "\n";
+		for (auto &[thread, s] : spans) {
+			fprintf(f, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d", sep, s.name,
+			        s.frame < 0 ? "phase" : "tile", thread);
+			fprintf(f, ",\"ts\":%.3f,\"dur\":%.3f", (s.begin - origin) * 1e-3, (s.end - s.begin) * 1e-3);
+			if (s.frame >= 0)
+				fprintf(f,
+				        ",\"args\":{\"frame\":%lld,\"x\":%d,\"y\":%d,\"width\":%d,\"height\":%d,"
+				        "\"iterations\":%lld,\"escaped\":%d,\"interior\":%d}",
+				        s.frame, s.x0, s.y0, s.x1 - s.x0, s.y1 - s.y0, s.iterations, s.escaped,
+				        s.interior);
+			fprintf(f, "}");
+			sep = ",\n";
+		}
+		fprintf(f, "\n]}\n");
+		return fclose(f) == 0;
+	}
+
+	private:
+	static std::atomic<bool> &on()
+	{
+		static std::atomic<bool> b{false};
+		return b;
+	}
+
+	// rings live as long as the program, a thread that ends leaves its spans behind
+	static trace_ring &ring()
+	{
+		thread_local trace_ring *r = [] {
+			std::lock_guard<std::mutex> lock(rings_lock());
+			rings().push_back(std::make_unique<trace_ring>());
+			rings().back()->thread = (int)rings().size();
+			return rings().back().get();
+		}();
+		return *r;
+	}
+
+	static std::vector<std::unique_ptr<trace_ring>> &rings()
+	{
+		static std::vector<std::unique_ptr<trace_ring>> r;
+		return r;
+	}
+
+	static std::mutex &rings_lock()
+	{
+		static std::mutex m;
+		return m;
+	}
+};
+
 #define PROF	Profiler _prof(__FUNCTION__)
 
 class Profiler
 {
 public:
+	// calls and time of a name over the run of the program
+	struct Total
+	{
+		long long count = 0;
+		double seconds = 0;
+	};
+
 	Profiler()
 	{
 		start();
 	}
 
+	// a named profiler adds its lifetime to the totals of its name and, while tracing, traces it as a
+	// phase. see PROF
+	explicit Profiler(const char *name) : name(name)
+	{
+		start();
+	}
+
 	~Profiler()
 	{
-		double t = elapsed_time();
+		if (!name)
+			return;
+		const uint64_t end = monotonic_ns();
+		add(name, (end - beg) * 1e-9);
+		if (trace::enabled()) {
+			trace_span s;
+			s.name = name;
+			s.begin = beg;
+			s.end = end;
+			trace::record(s);
+		}
 	}
 
 	void start()
 	{
-#ifdef WIN32
-		LARGE_INTEGER i;
-		QueryPerformanceCounter(&i);
-		beg = i.QuadPart;
-		QueryPerformanceFrequency(&freq);
-#else
-		timeval tv;
-		gettimeofday(&tv, nullptr);
-		beg = tv.tv_sec * 1000 * 1000 + tv.tv_usec;
-#endif
+		beg = monotonic_ns();
 	}
 
 	double elapsed_time() const
 	{
-#ifdef WIN32
-		LARGE_INTEGER end;
-		QueryPerformanceCounter(&end);
-		return double(end.QuadPart - beg) / double(freq.QuadPart);
-#else
-		timeval tv;
-		gettimeofday(&tv, nullptr);
-		uint64_t end = tv.tv_sec * 1000 * 1000 + tv.tv_usec;
-		return double(end - beg) / double(1000 * 1000);
-#endif
+		return double(monotonic_ns() - beg) * 1e-9;
 	}
 
 	static double get()
 	{
-#ifdef WIN32
-		LARGE_INTEGER end, freq;
-		QueryPerformanceCounter(&end);
-		QueryPerformanceFrequency(&freq);
-		return double(end.QuadPart) / double(freq.QuadPart);
-#else
-		timeval tv;
-		gettimeofday(&tv, nullptr);
-		uint64_t end = tv.tv_sec * 1000 * 1000 + tv.tv_usec;
-		return double(end) / double(1000 * 1000);
-#endif
+		return double(monotonic_ns()) * 1e-9;
 	}
+
+	static std::map<std::string, Total> totals()
+	{
+		std::lock_guard<std::mutex> lock(table_lock());
+		return table();
+	}
+
+	static void reset()
+	{
+		std::lock_guard<std::mutex> lock(table_lock());
+		table().clear();
+	}
+
 private:
+	static void add(const char *name, double seconds)
+	{
+		std::lock_guard<std::mutex> lock(table_lock());
+		Total &t = table()[name];
+		t.count++;
+		t.seconds += seconds;
+	}
+
+	static std::map<std::string, Total> &table()
+	{
+		static std::map<std::string, Total> t;
+		return t;
+	}
+
+	static std::mutex &table_lock()
+	{
+		static std::mutex m;
+		return m;
+	}
+
+	const char *name = nullptr;
 	uint64_t beg;
-#ifdef WIN32
-	LARGE_INTEGER freq;
-#endif
 };
@@ -0,0 +1,150 @@
+#pragma once
+#include <stdio.h>
+#include <string>
+
+// the iteration step of the kernels as a policy type, so every formula gets inner loops of its own without a
+// branch per iteration. step() takes z = (u, v) with its squares uu and vv, which the escape test computed
+// already, and c = (cu, cv). X is any of the precisions or their lanes.
+
+// |x| of the scalar precisions, the lane types have their own in simd.h
+template <typename X> X absolute(const X &x) { return x < X(0) ? -x : x; }
+
+// z^2 + c from z = 0
+struct mandelbrot_step {
+	// false: z starts at 0 and c is the point. true: z starts at the point and c is the policy's cx, cy
+	static constexpr bool fixed_c = false;
+	// the main cardioid and the period 2 bulb are inside, the kernels test them in closed form
+	static constexpr bool interior = true;
+	// dz/dc = 2 z dz/dc + 1, the kernels can estimate distances and perturbation applies
+	static constexpr bool derivative = true;
+
+	template <typename X> static void step(X &u, X &v, const X &uu, const X &vv, const X &cu, const X &cv)
+	{
+		X uv = u * v;
+		v = uv + uv + cv;
+		u = uu - vv + cu;
+	}
+};
+
+// z^2 + c of one c for the whole plane, z starts at the point
+struct julia_step {
+	static constexpr bool fixed_c = true;
+	static constexpr bool interior = false;
+	static constexpr bool derivative = false;
+
+	double cx = -0.8, cy = 0.156;
+
+	template <typename X> static void step(X &u, X &v, const X &uu, const X &vv, const X &cu, const X &cv)
+	{
+		mandelbrot_step::step(u, v, uu, vv, cu, cv);
+	}
+};
+
+// z^2 + c with both parts of z made positive before squaring, only the imaginary part 2 |u v| notices
+struct burning_ship_step {
+	static constexpr bool fixed_c = false;
+	static constexpr bool interior = false;
+	static constexpr bool derivative = false;
+
+	template <typename X> static void step(X &u, X &v, const X &uu, const X &vv, const X &cu, const X &cv)
+	{
+		X uv = u * v;
+		v = absolute(uv + uv) + cv;
+		u = uu - vv + cu;
+	}
+};
+
+// z^D + c from z = 0. z^2 comes from the squares, every further power is one complex multiplication the
+// compiler unrolls.
+template <int D> struct multibrot_step {
+	static_assert(D > 2, "degree 2 is mandelbrot_step");
+	static constexpr bool fixed_c = false;
+	static constexpr bool interior = false;
+	static constexpr bool derivative = false;
+
+	template <typename X> static void step(X &u, X &v, const X &uu, const X &vv, const X &cu, const X &cv)
+	{
+		X uv = u * v;
+		X pu = uu - vv, pv = uv + uv;
+		for (int k = 2; k < D; ++k) {
+			X next = pu * u - pv * v;
+			pv = pu * v + pv * u;
+			pu = next;
+		}
+		u = pu + cu;
+		v = pv + cv;
+	}
+};
+
+// the formulas as chosen at runtime, like Precision
+enum class Formula {
+	Mandelbrot = 0,
+	Julia = 1,
+	BurningShip = 2,
+	Multibrot = 3,
+};
+
+// names of the formulas in job files and on the command line, in the order of the enum
+constexpr const char *formula_names[] = {"mandelbrot", "julia", "burning-ship", "multibrot"};
+
+// the multibrot degrees that have kernels
+constexpr int multibrot_min_degree = 3;
+constexpr int multibrot_max_degree = 5;
+
+struct FormulaParams {
+	Formula formula = Formula::Mandelbrot;
+	// c of the julia set
+	double cx = -0.8, cy = 0.156;
+	// of the multibrot
+	int degree = 3;
+};
+
+// f(step) with the policy of p, the one switch between a runtime choice and the kernels
+template <typename F> auto with_formula(const FormulaParams &p, F &&f)
+{
+	switch (p.formula) {
+	case Formula::Mandelbrot:
+		break;
+	case Formula::Julia:
+		return f(julia_step{p.cx, p.cy});
+	case Formula::BurningShip:
+		return f(burning_ship_step());
+	case Formula::Multibrot:
+		if (p.degree == 4)
+			return f(multibrot_step<4>());
+		if (p.degree == 5)
+			return f(multibrot_step<5>());
+		return f(multibrot_step<3>());
+	}
+	return f(mandelbrot_step());
+}
+
+// "mandelbrot", "julia" or "julia:cx,cy", "burning-ship", "multibrot" or "multibrot:degree". false for
+// anything else, p is only written on success.
+inline bool parse_formula(const std::string &s, FormulaParams &p)
+{
+	const size_t colon = s.find(':');
+	const std::string name = s.substr(0, colon);
+	const std::string args = colon == std::string::npos ? "" : s.substr(colon + 1);
+	FormulaParams q;
+	char end;
+	if (name == formula_names[0] && args.empty()) {
+		q.formula = Formula::Mandelbrot;
+	} else if (name == formula_names[1]) {
+		q.formula = Formula::Julia;
+		if (!args.empty() && sscanf(args.c_str(), "%lf,%lf%c", &q.cx, &q.cy, &end) != 2)
+			return false;
+	} else if (name == formula_names[2] && args.empty()) {
+		q.formula = Formula::BurningShip;
+	} else if (name == formula_names[3]) {
+		q.formula = Formula::Multibrot;
+		if (!args.empty() && sscanf(args.c_str(), "%d%c", &q.degree, &end) != 1)
+			return false;
+		if (q.degree < multibrot_min_degree || q.degree > multibrot_max_degree)
+			return false;
+	} else {
+		return false;
+	}
+	p = q;
+	return true;
+}
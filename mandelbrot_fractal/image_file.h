@@ -0,0 +1,154 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "mandelbrot.h"
+
+#if !defined(HAVE_ZLIB)
+#define HAVE_ZLIB 0
+#endif
+
+#if HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+// writes the colors of an image to PPM or PNG files. row 0 of an image is the bottom of the view, the files
+// start with the top row.
+
+// row y of the file as 8 bit RGB
+inline void rgb_row(const Image &image, int y, uint8_t *dst)
+{
+	const uint8_t *src = image.buf + size_t(image.height - 1 - y) * image.width * 4;
+	for (int x = 0; x < image.width; ++x) {
+		dst[3 * x] = src[4 * x];
+		dst[3 * x + 1] = src[4 * x + 1];
+		dst[3 * x + 2] = src[4 * x + 2];
+	}
+}
+
+inline bool write_ppm(const Image &image, const std::string &path)
+{
+	FILE *f = fopen(path.c_str(), "wb");
+	if (!f)
+		return false;
+	fprintf(f, "P6\n%d %d\n255\n", image.width, image.height);
+	std::vector<uint8_t> row(size_t(image.width) * 3);
+	bool ok = true;
+	for (int y = 0; y < image.height && ok; ++y) {
+		rgb_row(image, y, row.data());
+		ok = fwrite(row.data(), 1, row.size(), f) == row.size();
+	}
+	return fclose(f) == 0 && ok;
+}
+
+inline uint32_t png_crc(const uint8_t *data, size_t size, uint32_t crc = 0)
+{
+	static const std::vector<uint32_t> table = [] {
+		std::vector<uint32_t> t(256);
+		for (uint32_t i = 0; i < 256; ++i) {
+			uint32_t c = i;
+			for (int k = 0; k < 8; ++k)
+				c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+			t[i] = c;
+		}
+		return t;
+	}();
+	crc = ~crc;
+	for (size_t i = 0; i < size; ++i)
+		crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+// zlib stream of data. without zlib the deflate blocks are stored uncompressed, still a valid PNG.
+inline std::vector<uint8_t> png_deflate(const std::vector<uint8_t> &data)
+{
+#if HAVE_ZLIB
+	uLongf size = compressBound((uLong)data.size());
+	std::vector<uint8_t> out(size);
+	if (compress2(out.data(), &size, data.data(), (uLong)data.size(), Z_BEST_SPEED) != Z_OK)
+		return {};
+	out.resize(size);
+	return out;
+#else
+	std::vector<uint8_t> out = {0x78, 0x01};
+	size_t at = 0;
+	do {
+		const size_t len = std::min<size_t>(65535, data.size() - at);
+		out.push_back(at + len == data.size());
+		out.push_back(uint8_t(len));
+		out.push_back(uint8_t(len >> 8));
+		out.push_back(uint8_t(~len));
+		out.push_back(uint8_t(~len >> 8));
+		out.insert(out.end(), data.begin() + at, data.begin() + at + len);
+		at += len;
+	} while (at < data.size());
+	uint32_t a = 1, b = 0;
+	for (uint8_t c : data) {
+		a = (a + c) % 65521;
+		b = (b + a) % 65521;
+	}
+	const uint32_t adler = b << 16 | a;
+	for (int s = 24; s >= 0; s -= 8)
+		out.push_back(uint8_t(adler >> s));
+	return out;
+#endif
+}
+
+// the PNG file of the colors of an image, empty when compressing failed
+inline std::vector<uint8_t> encode_png(const Image &image)
+{
+	// every row with the sub filter, the smooth colorings leave small differences between neighbours
+	const size_t stride = size_t(image.width) * 3;
+	std::vector<uint8_t> raw((stride + 1) * image.height);
+	std::vector<uint8_t> row(stride);
+	for (int y = 0; y < image.height; ++y) {
+		rgb_row(image, y, row.data());
+		uint8_t *dst = raw.data() + (stride + 1) * y;
+		dst[0] = 1;
+		for (size_t i = 0; i < stride; ++i)
+			dst[1 + i] = uint8_t(row[i] - (i >= 3 ? row[i - 3] : 0));
+	}
+	std::vector<uint8_t> idat = png_deflate(raw);
+	if (idat.empty())
+		return {};
+
+	std::vector<uint8_t> png = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+	auto put = [&png](const char *type, const std::vector<uint8_t> &body) {
+		uint8_t head[8] = {uint8_t(body.size() >> 24), uint8_t(body.size() >> 16), uint8_t(body.size() >> 8),
+		                   uint8_t(body.size()),       uint8_t(type[0]),           uint8_t(type[1]),
+		                   uint8_t(type[2]),           uint8_t(type[3])};
+		const uint32_t crc = png_crc(body.data(), body.size(), png_crc(head + 4, 4));
+		const uint8_t tail[4] = {uint8_t(crc >> 24), uint8_t(crc >> 16), uint8_t(crc >> 8), uint8_t(crc)};
+		png.insert(png.end(), head, head + 8);
+		png.insert(png.end(), body.begin(), body.end());
+		png.insert(png.end(), tail, tail + 4);
+	};
+	const uint32_t w = image.width, h = image.height;
+	// 8 bit RGB, no interlacing
+	put("IHDR", {uint8_t(w >> 24), uint8_t(w >> 16), uint8_t(w >> 8), uint8_t(w), uint8_t(h >> 24), uint8_t(h >> 16),
+	             uint8_t(h >> 8), uint8_t(h), 8, 2, 0, 0, 0});
+	put("IDAT", idat);
+	put("IEND", {});
+	return png;
+}
+
+inline bool write_png(const Image &image, const std::string &path)
+{
+	const std::vector<uint8_t> png = encode_png(image);
+	if (png.empty())
+		return false;
+	FILE *f = fopen(path.c_str(), "wb");
+	if (!f)
+		return false;
+	const bool ok = fwrite(png.data(), 1, png.size(), f) == png.size();
+	return fclose(f) == 0 && ok;
+}
+
+// PNG when the path ends in .png, PPM otherwise
+inline bool write_image(const Image &image, const std::string &path)
+{
+	const bool png = path.size() >= 4 && path.compare(path.size() - 4, 4, ".png") == 0;
+	return png ? write_png(image, path) : write_ppm(image, path);
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+#include <string>
+#include "mandelbrot.h"
+
+// automatic max_iterations. the zoom depth sets a floor that grows with the magnification, the escape
+// iterations of the last finished frame move the limit from there: pixels still escaping close to the limit
+// mean part of what shows as inside the set would escape with a higher one, and a frame whose last pixel
+// escapes far below the limit spends the difference on every interior pixel for nothing.
+
+constexpr int auto_min_iterations = 256;
+constexpr int auto_max_iterations = 1 << 22;
+// the limit doubles while at least this share of the pixels escapes in its last quarter
+constexpr double near_limit_share = 1e-3;
+
+// where the pixels of a frame computed with n iterations escaped
+struct escape_stats {
+	int n = 0;
+	long long pixels = 0;
+	long long escaped = 0;
+	// escaped in the last quarter below n
+	long long near_limit = 0;
+	// the highest escape iteration, -1 when nothing escaped
+	int highest = -1;
+};
+
+inline escape_stats count_escapes(const Image &image, int n)
+{
+	escape_stats s;
+	s.n = n;
+	s.pixels = (long long)image.width * image.height;
+	const int near = n - n / 4;
+	for (long long i = 0; i < s.pixels; ++i) {
+		const int it = image.iter[i];
+		if (it < 0 || it >= n)
+			continue;
+		s.escaped++;
+		s.near_limit += it >= near;
+		s.highest = std::max(s.highest, it);
+	}
+	return s;
+}
+
+struct iteration_choice {
+	int n;
+	// why, for the ui
+	std::string reason;
+};
+
+// the floor of a view extent wide on the real axis, 256 for the whole set and 256 more per decade of zoom
+inline int depth_iterations(double extent)
+{
+	const double decades = extent > 0 ? std::max(0.0, log10(4 / extent)) : 0;
+	return int(std::min<double>(auto_max_iterations, auto_min_iterations * (1 + decades)));
+}
+
+// max_iterations of a view extent wide, last are the escapes of the last finished frame or empty
+inline iteration_choice choose_iterations(double extent, const escape_stats &last)
+{
+	char reason[160];
+	const int floor = depth_iterations(extent);
+	const double zoom = extent > 0 ? log10(4 / extent) : 0;
+	int n = floor;
+	snprintf(reason, sizeof(reason), "zoom 1e%.0f needs at least %d", zoom, floor);
+	if (last.n > 0 && last.pixels > 0) {
+		const double share = double(last.near_limit) / last.pixels;
+		if (share >= near_limit_share) {
+			n = (int)std::min(last.n * 2LL, (long long)auto_max_iterations);
+			snprintf(reason, sizeof(reason), "%.2f%% of the pixels escaped between %d and %d, raised",
+			         share * 100, last.n - last.n / 4, last.n);
+		} else if (last.highest < last.n / 4) {
+			// twice the last escape leaves room for the pixels around it
+			n = std::max(2 * last.highest, auto_min_iterations);
+			if (last.escaped)
+				snprintf(reason, sizeof(reason), "the last pixel escaped at %d of %d, lowered",
+				         last.highest, last.n);
+			else
+				snprintf(reason, sizeof(reason), "nothing escaped below %d, lowered", last.n);
+		} else {
+			n = last.n;
+			snprintf(reason, sizeof(reason), "%.2f%% of the pixels escaped near %d, kept", share * 100,
+			         last.n);
+		}
+		if (n < floor) {
+			n = floor;
+			snprintf(reason, sizeof(reason), "zoom 1e%.0f needs at least %d", zoom, floor);
+		}
+	}
+	return {n, reason};
+}
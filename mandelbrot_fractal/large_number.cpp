@@ -1,9 +1,6 @@
 #include "large_number.h"
 
-typedef LargeNumber<4, 4> Large;
-
-void test_me()
-{
-	Large a{ 0.1 }, b{ 0.2 }, c{ -0.3 };
-	a += b;
-}
\ No newline at end of file
+// the widths offered as precisions, instantiated here so every member gets compiled
+template class LargeNumber<2, 16>;
+template class LargeNumber<3, 16>;
+template class LargeNumber<4, 16>;
@@ -6,27 +6,143 @@
 #endif
 #include <cmath>
 #include <stdint.h>
+#include <string.h>
 #include <assert.h>
+#include <string>
 
+// 64x64 -> 128 bit multiply and add with carry, mulx/adcx when the cpu has them
+inline uint64_t mul64(uint64_t a, uint64_t b, uint64_t *hi)
+{
+#if defined(__BMI2__)
+	unsigned long long h;
+	uint64_t lo = _mulx_u64(a, b, &h);
+	*hi = h;
+	return lo;
+#elif defined(_MSC_VER)
+	return _umul128(a, b, hi);
+#else
+	unsigned __int128 p = (unsigned __int128)a * b;
+	*hi = uint64_t(p >> 64);
+	return uint64_t(p);
+#endif
+}
+
+inline uint8_t addc64(uint8_t c, uint64_t a, uint64_t b, uint64_t *out)
+{
+	unsigned long long r;
+#if defined(__ADX__)
+	c = _addcarryx_u64(c, a, b, &r);
+#else
+	c = _addcarry_u64(c, a, b, &r);
+#endif
+	*out = r;
+	return c;
+}
+
+// signed two's complement fixed point number of N 64 bit limbs, mantissa[0] is the most significant one.
+// POINT_BIT bits (sign included) are left of the binary point, 64 * N - POINT_BIT bits are right of it.
 template <int N, int POINT_BIT> class LargeNumber {
+	static_assert(POINT_BIT > 0 && POINT_BIT < 64, "the binary point has to be inside the first limb");
+
 	public:
+	static constexpr int fraction_bits = 64 * N - POINT_BIT;
+
 	LargeNumber() { memset(mantissa, 0, sizeof(mantissa)); }
 
-	explicit LargeNumber(float a)
+	LargeNumber(int a)
+	{
+		memset(mantissa, 0, sizeof(mantissa));
+		mantissa[0] = uint64_t(int64_t(a)) << (64 - POINT_BIT);
+	}
+
+	explicit LargeNumber(float a) { from_float(double(a)); }
+
+	explicit LargeNumber(double a) { from_float(a); }
+
+	// any floating type with ldexp and floor found by ADL or in std, boost float128 included
+	template <typename F, typename = decltype(F(1.5) * F(0.5))> explicit LargeNumber(const F &a) { from_float(a); }
+
+	template <int M> explicit LargeNumber(const LargeNumber<M, POINT_BIT> &a)
+	{
+		memset(mantissa, 0, sizeof(mantissa));
+		for (int i = 0; i < N && i < M; ++i)
+			mantissa[i] = a.limb(i);
+	}
+
+	template <typename F> F to() const
+	{
+		using namespace std;
+		LargeNumber<N, POINT_BIT> m = negative() ? -*this : *this;
+		F r = 0;
+		for (int i = N - 1; i >= 0; --i)
+			r += ldexp(F(m.mantissa[i]), POINT_BIT - 64 * (i + 1));
+		return negative() ? -r : r;
+	}
+
+	explicit operator float() const { return to<float>(); }
+	explicit operator double() const { return to<double>(); }
+
+	// decimal expansion with enough digits to tell neighbouring values apart
+	std::string str() const
+	{
+		LargeNumber<N, POINT_BIT> m = negative() ? -*this : *this;
+		std::string s = negative() ? "-" : "";
+		s += std::to_string(m.mantissa[0] >> (64 - POINT_BIT));
+		s += '.';
+		m.mantissa[0] &= ~uint64_t(0) >> POINT_BIT;
+
+		int digits = fraction_bits * 30103 / 100000 + 1;
+		for (int d = 0; d < digits; ++d) {
+			// m *= 10, the digit spills over into the integer bits
+			uint64_t carry = 0;
+			for (int i = N - 1; i >= 0; --i) {
+				uint64_t hi, lo = mul64(m.mantissa[i], 10, &hi);
+				uint8_t c = addc64(0, lo, carry, &m.mantissa[i]);
+				carry = hi + c;
+			}
+			s += char('0' + (m.mantissa[0] >> (64 - POINT_BIT)));
+			m.mantissa[0] &= ~uint64_t(0) >> POINT_BIT;
+		}
+		while (s.back() == '0' && s[s.size() - 2] != '.')
+			s.pop_back();
+		return s;
+	}
+
+	// the inverse of str() for plain decimals "[-]int[.frac]", the integer part has to fit the integer bits.
+	// the fraction is rounded down to fraction_bits.
+	static LargeNumber<N, POINT_BIT> from_decimal(const std::string &s)
 	{
-		int ai = floor(a);
-		float af = a - ai;
+		const bool neg = !s.empty() && s[0] == '-';
+		const size_t first = !s.empty() && (s[0] == '-' || s[0] == '+') ? 1 : 0;
+		size_t dot = s.find('.', first);
+		if (dot == std::string::npos)
+			dot = s.size();
+
+		// the fraction from its last digit up, m = (m + digit) / 10
+		LargeNumber<N, POINT_BIT> m;
+		for (size_t i = s.size(); i-- > dot + 1;) {
+			m.mantissa[0] += uint64_t(s[i] - '0') << (64 - POINT_BIT);
+			m.divide(10);
+		}
+		uint64_t whole = 0;
+		for (size_t i = first; i < dot; ++i)
+			whole = whole * 10 + uint64_t(s[i] - '0');
+		assert(whole < uint64_t(1) << (POINT_BIT - 1));
+		m.mantissa[0] |= whole << (64 - POINT_BIT);
+		if (neg)
+			m.negate();
+		return m;
 	}
 
-	explicit LargeNumber(double a) {}
+	uint64_t limb(int i) const { return mantissa[i]; }
+	bool negative() const { return int64_t(mantissa[0]) < 0; }
 
 	LargeNumber<N, POINT_BIT> &operator+=(const LargeNumber<N, POINT_BIT> &a)
 	{
 		uint8_t c = 0;
 		for (int i = N - 1; i >= 0; --i) {
-			c = _addcarry_u64(c, mantissa[i], a.mantissa[i], &mantissa[i]);
+			c = addc64(c, mantissa[i], a.mantissa[i], &mantissa[i]);
 		}
-		// assert(c == 0);
 		return *this;
 	}
 
@@ -34,14 +150,210 @@ template <int N, int POINT_BIT> class LargeNumber {
 	{
 		uint8_t c = 0;
 		for (int i = N - 1; i >= 0; --i) {
-			c = _subborrow_u64(c, mantissa[i], a.mantissa[i], &mantissa[i]);
+			unsigned long long r;
+			c = _subborrow_u64(c, mantissa[i], a.mantissa[i], &r);
+			mantissa[i] = r;
 		}
-		assert(c == 0);
 		return *this;
 	}
 
-	LargeNumber<N, POINT_BIT> &operator*=(const LargeNumber<N, POINT_BIT> &a) {}
+	LargeNumber<N, POINT_BIT> &operator*=(const LargeNumber<N, POINT_BIT> &a)
+	{
+		bool neg = negative() != a.negative();
+		LargeNumber<N, POINT_BIT> x = negative() ? -*this : *this;
+		LargeNumber<N, POINT_BIT> y = a.negative() ? -a : a;
+
+		uint64_t p[2 * N];
+		x.mul(y, p);
+		narrow(p);
+		if (neg)
+			negate();
+		return *this;
+	}
+
+	LargeNumber<N, POINT_BIT> &operator/=(const LargeNumber<N, POINT_BIT> &a)
+	{
+		bool neg = negative() != a.negative();
+		LargeNumber<N, POINT_BIT> x = negative() ? -*this : *this;
+		LargeNumber<N, POINT_BIT> y = a.negative() ? -a : a;
+
+		// restoring division of x << fraction_bits by y, one quotient bit per step. rem < y < 2^(64N - 1)
+		// so the shifted remainder still fits, it is compared unsigned.
+		memset(mantissa, 0, sizeof(mantissa));
+		LargeNumber<N, POINT_BIT> rem;
+		for (int bit = 64 * N + fraction_bits - 1; bit >= 0; --bit) {
+			rem.shl1();
+			if (bit >= fraction_bits)
+				rem.mantissa[N - 1] |= (x.mantissa[N - 1 - (bit - fraction_bits) / 64] >>
+				                        ((bit - fraction_bits) % 64)) &
+				                       1;
+			if (!rem.below(y)) {
+				rem -= y;
+				if (bit < 64 * N)
+					mantissa[N - 1 - bit / 64] |= uint64_t(1) << (bit % 64);
+			}
+		}
+		if (neg)
+			negate();
+		return *this;
+	}
+
+	LargeNumber<N, POINT_BIT> operator-() const
+	{
+		LargeNumber<N, POINT_BIT> r = *this;
+		r.negate();
+		return r;
+	}
+
+	// x * x with every cross product computed once
+	LargeNumber<N, POINT_BIT> square() const
+	{
+		LargeNumber<N, POINT_BIT> x = negative() ? -*this : *this;
+		uint64_t p[2 * N];
+		memset(p, 0, sizeof(p));
+		// little endian copy, p[0] is the least significant limb
+		uint64_t a[N];
+		for (int i = 0; i < N; ++i)
+			a[i] = x.mantissa[N - 1 - i];
+
+		for (int i = 0; i < N; ++i) {
+			uint64_t carry = 0;
+			for (int j = i + 1; j < N; ++j)
+				carry = mac(p[i + j], a[i], a[j], carry);
+			p[i + N] = carry;
+		}
+		for (int i = 2 * N - 1; i >= 0; --i)
+			p[i] = (p[i] << 1) | (i > 0 ? p[i - 1] >> 63 : 0);
+		uint8_t c = 0;
+		for (int i = 0; i < N; ++i) {
+			uint64_t hi, lo = mul64(a[i], a[i], &hi);
+			c = addc64(c, p[2 * i], lo, &p[2 * i]);
+			c = addc64(c, p[2 * i + 1], hi, &p[2 * i + 1]);
+		}
+
+		LargeNumber<N, POINT_BIT> r;
+		r.narrow(p);
+		return r;
+	}
+
+	friend LargeNumber<N, POINT_BIT> operator+(LargeNumber<N, POINT_BIT> a, const LargeNumber<N, POINT_BIT> &b)
+	{
+		return a += b;
+	}
+	friend LargeNumber<N, POINT_BIT> operator-(LargeNumber<N, POINT_BIT> a, const LargeNumber<N, POINT_BIT> &b)
+	{
+		return a -= b;
+	}
+	friend LargeNumber<N, POINT_BIT> operator*(LargeNumber<N, POINT_BIT> a, const LargeNumber<N, POINT_BIT> &b)
+	{
+		return a *= b;
+	}
+	friend LargeNumber<N, POINT_BIT> operator/(LargeNumber<N, POINT_BIT> a, const LargeNumber<N, POINT_BIT> &b)
+	{
+		return a /= b;
+	}
+
+	friend bool operator<(const LargeNumber<N, POINT_BIT> &a, const LargeNumber<N, POINT_BIT> &b)
+	{
+		if (a.mantissa[0] != b.mantissa[0])
+			return int64_t(a.mantissa[0]) < int64_t(b.mantissa[0]);
+		for (int i = 1; i < N; ++i)
+			if (a.mantissa[i] != b.mantissa[i])
+				return a.mantissa[i] < b.mantissa[i];
+		return false;
+	}
+	friend bool operator>(const LargeNumber<N, POINT_BIT> &a, const LargeNumber<N, POINT_BIT> &b) { return b < a; }
+	friend bool operator<=(const LargeNumber<N, POINT_BIT> &a, const LargeNumber<N, POINT_BIT> &b) { return !(b < a); }
+	friend bool operator>=(const LargeNumber<N, POINT_BIT> &a, const LargeNumber<N, POINT_BIT> &b) { return !(a < b); }
+	friend bool operator==(const LargeNumber<N, POINT_BIT> &a, const LargeNumber<N, POINT_BIT> &b)
+	{
+		return memcmp(a.mantissa, b.mantissa, sizeof(a.mantissa)) == 0;
+	}
+	friend bool operator!=(const LargeNumber<N, POINT_BIT> &a, const LargeNumber<N, POINT_BIT> &b) { return !(a == b); }
 
 	private:
-	unsigned long long int mantissa[N];
+	// acc += a * b + carry, returns the high word
+	static uint64_t mac(uint64_t &acc, uint64_t a, uint64_t b, uint64_t carry)
+	{
+		uint64_t hi, lo = mul64(a, b, &hi);
+		uint8_t c0 = addc64(0, acc, lo, &acc);
+		uint8_t c1 = addc64(0, acc, carry, &acc);
+		return hi + c0 + c1;
+	}
+
+	// unsigned 2N limb little endian product of the magnitudes
+	void mul(const LargeNumber<N, POINT_BIT> &b, uint64_t *p) const
+	{
+		memset(p, 0, sizeof(uint64_t) * 2 * N);
+		for (int i = 0; i < N; ++i) {
+			uint64_t carry = 0;
+			uint64_t ai = mantissa[N - 1 - i];
+			for (int j = 0; j < N; ++j)
+				carry = mac(p[i + j], ai, b.mantissa[N - 1 - j], carry);
+			p[i + N] = carry;
+		}
+	}
+
+	// keeps the product bits that line up with the binary point, truncating the rest
+	void narrow(const uint64_t *p)
+	{
+		constexpr int s = 64 - POINT_BIT;
+		for (int j = 0; j < N; ++j)
+			mantissa[N - 1 - j] = (p[j + N - 1] >> s) | (p[j + N] << (64 - s));
+	}
+
+	bool below(const LargeNumber<N, POINT_BIT> &a) const
+	{
+		for (int i = 0; i < N; ++i)
+			if (mantissa[i] != a.mantissa[i])
+				return mantissa[i] < a.mantissa[i];
+		return false;
+	}
+
+	void negate()
+	{
+		uint8_t c = 1;
+		for (int i = N - 1; i >= 0; --i)
+			c = addc64(c, ~mantissa[i], 0, &mantissa[i]);
+	}
+
+	// unsigned division by a small d, 32 bits at a time so the remainder never overflows
+	void divide(uint32_t d)
+	{
+		uint64_t rem = 0;
+		for (int i = 0; i < N; ++i) {
+			uint64_t hi = (rem << 32) | (mantissa[i] >> 32);
+			rem = hi % d;
+			uint64_t lo = (rem << 32) | (mantissa[i] & 0xffffffff);
+			rem = lo % d;
+			mantissa[i] = (hi / d << 32) | (lo / d);
+		}
+	}
+
+	void shl1()
+	{
+		for (int i = 0; i < N - 1; ++i)
+			mantissa[i] = (mantissa[i] << 1) | (mantissa[i + 1] >> 63);
+		mantissa[N - 1] <<= 1;
+	}
+
+	template <typename F> void from_float(const F &a)
+	{
+		using namespace std;
+		F t = ldexp(a < 0 ? F(-a) : a, 64 - POINT_BIT);
+		for (int i = 0; i < N; ++i) {
+			F limb = floor(t);
+			mantissa[i] = static_cast<uint64_t>(limb);
+			t = ldexp(t - limb, 64);
+		}
+		if (a < 0)
+			negate();
+	}
+
+	uint64_t mantissa[N];
 };
+
+template <int N, int POINT_BIT> LargeNumber<N, POINT_BIT> sqr(const LargeNumber<N, POINT_BIT> &a)
+{
+	return a.square();
+}
@@ -17,24 +17,50 @@
 
 #include "debugging.h"
 #include "mandelbrot.h"
+#include "perturbation.h"
 #include "pool.h"
 #include "palette.h"
+#include "subdivide.h"
+#include "progressive.h"
+#include "view_cache.h"
+#include "pan.h"
+#include "coloring.h"
+#include "render.h"
+#include "render_service.h"
+#include "texture_stream.h"
+#include "iterations.h"
 
 using namespace std;
 
-enum class Precision
-{
-	Single = 0,
-	Double = 1,
-	Large = 2,
-};
-
-static GLuint tex;
-static Image image;
+static texture_stream stream;
 
 static int max_iterations = 1024;
+// max_iterations follows the zoom depth and the escapes of the last finished frame
+static bool auto_iterations = false;
+static escape_stats last_escapes;
+static std::string iterations_reason;
+// width of the real axis of the frame on screen
+static double view_extent = 4;
+
+// 64x64 RGBA tiles fit in L1
+constexpr int tile_size = 64;
+// subdivision makes its own small tiles, larger roots find larger uniform areas
+constexpr int subdivide_tile_size = 256;
+static bool center_out = true;
+static bool subdivide = false;
+static bool progressive = false;
+static view_cache views;
+// right button drag pans
+static bool is_panning = false;
+static double pan_x, pan_y;
+// the palette changed, the iterations are colored again once no frame is running
+static bool recolor = false;
+static bool cycle_colors = false;
 
 Palette palette;
+static histogram hist;
+// colors whole frames, the render workers of service may still be busy with a frame meanwhile
+static pool coloring_workers;
 
 static bool is_dragging = false;
 static Rect<int> drag = {-1, -1, -1, -1};
@@ -42,14 +68,45 @@ static Rect<int> drag = {-1, -1, -1, -1};
 static Rect<fp> fractal;
 static std::list<Rect<fp>> zoom_history;
 
-static pool calc_pool;
+static render_service service;
+// the newest job, its image is the one on screen
+static shared_ptr<render_job> frame;
+static double execution_time_sec = 0;
 
-static Profiler prof;
-static struct progress_info prog_info;
 static int precision = static_cast<int>(Precision::Single);
+// precision follows the pixel spacing of the view
+static bool auto_precision = false;
+#if LARGE_NUMBERS
+static shared_ptr<ReferenceStats> reference;
+#endif
+static FormulaParams formula;
+
+// distances are estimated for the distance coloring, the kernels only have them for the mandelbrot formula
+static bool wants_distance()
+{
+	return palette.coloring == Coloring::Distance && formula.formula == Formula::Mandelbrot;
+}
 
 constexpr int smoothed_n = 60;
 static double fps = 0;
+
+// wall time the tiles of the finished frame took per cell of the screen, from the trace
+constexpr int heatmap_cell = 64;
+struct heatmap {
+	int columns = 0;
+	int rows = 0;
+	std::vector<double> cost;
+	double peak = 0;
+
+	int tiles = 0;
+	double slowest_ms = 0;
+	double mean_ms = 0;
+	double interior = 0;
+	double miter_per_sec = 0;
+};
+static bool tracing = false;
+static bool show_heatmap = false;
+static heatmap heat;
 static double smoothed_fps[smoothed_n];
 
 template <typename T> Rect<fp> f(Precision p, const Rect<T> &s)
@@ -61,7 +118,18 @@ template <typename T> Rect<fp> f(Precision p, const Rect<T> &s)
 		return {e<double>(s.x0), e<double>(s.x1), e<double>(s.y0), e<double>(s.y1)};
 #if LARGE_NUMBERS
 	case Precision::Large:
-		return {(float128)s.x0, (float128)s.x1, (float128)s.y0, (float128)s.y1};
+	case Precision::Perturbation:
+		return {e<float128>(s.x0), e<float128>(s.x1), e<float128>(s.y0), e<float128>(s.y1)};
+	case Precision::Fixed128:
+		return {e<fixed128>(s.x0), e<fixed128>(s.x1), e<fixed128>(s.y0), e<fixed128>(s.y1)};
+	case Precision::Fixed192:
+		return {e<fixed192>(s.x0), e<fixed192>(s.x1), e<fixed192>(s.y0), e<fixed192>(s.y1)};
+	case Precision::Fixed256:
+		return {e<fixed256>(s.x0), e<fixed256>(s.x1), e<fixed256>(s.y0), e<fixed256>(s.y1)};
+	case Precision::DoubleDouble:
+		return {e<dd_real>(s.x0), e<dd_real>(s.x1), e<dd_real>(s.y0), e<dd_real>(s.y1)};
+	case Precision::QuadDouble:
+		return {e<qd_real>(s.x0), e<qd_real>(s.x1), e<qd_real>(s.y0), e<qd_real>(s.y1)};
 #endif
 	}
 	assert(false);
@@ -84,49 +152,188 @@ template <typename T> Rect<T> fix_aspect_ratio(const Rect<T> &model, int width,
 	return {model.x0, model.x0 + model_width, model.y0, model.y0 + model_height};
 }
 
-template <typename T> Rect<fp> update_fractal(Image &image, const Rect<T> &next_fractal)
+static int worker_count() { return min(16, (int)thread::hardware_concurrency()); }
+
+static void build_heatmap(const render_job &job)
+{
+	const Image &image = job.image;
+	heat = {};
+	heat.columns = (image.width + heatmap_cell - 1) / heatmap_cell;
+	heat.rows = (image.height + heatmap_cell - 1) / heatmap_cell;
+	heat.cost.assign(heat.columns * heat.rows, 0);
+
+	double total_ns = 0;
+	long long iterations = 0, pixels = 0, interior = 0;
+	for (const auto &[thread, s] : trace::collect()) {
+		if (s.frame != (long long)job.generation)
+			continue;
+		const double ns = double(s.end - s.begin);
+		// the time of a tile is shared by the cells it overlaps by area, subdivided tiles span several
+		const double area = double(s.x1 - s.x0) * (s.y1 - s.y0);
+		for (int cy = s.y0 / heatmap_cell; cy * heatmap_cell < s.y1; ++cy) {
+			for (int cx = s.x0 / heatmap_cell; cx * heatmap_cell < s.x1; ++cx) {
+				const int w = min(s.x1, (cx + 1) * heatmap_cell) - max(s.x0, cx * heatmap_cell);
+				const int h = min(s.y1, (cy + 1) * heatmap_cell) - max(s.y0, cy * heatmap_cell);
+				heat.cost[cy * heat.columns + cx] += ns * w * h / area;
+			}
+		}
+		heat.slowest_ms = max(heat.slowest_ms, ns * 1e-6);
+		heat.tiles++;
+		total_ns += ns;
+		iterations += s.iterations;
+		pixels += s.escaped + s.interior;
+		interior += s.interior;
+	}
+	for (double c : heat.cost)
+		heat.peak = max(heat.peak, c);
+	if (heat.tiles)
+		heat.mean_ms = total_ns * 1e-6 / heat.tiles;
+	if (pixels)
+		heat.interior = 100.0 * interior / pixels;
+	if (job.progress.execution_time_sec > 0)
+		heat.miter_per_sec = iterations * 1e-6 / job.progress.execution_time_sec;
+}
+
+// renders next_fractal into job and makes it the frame on screen, the frame before is abandoned. missing >= 0
+// when the image of job holds the shifted previous frame with that many pixels marked missing.
+template <typename T>
+Rect<fp> update_fractal(shared_ptr<render_job> job, const Rect<T> &next_fractal, bool perturbed, long long missing = -1)
 {
-	Rect<T> fractal = fix_aspect_ratio(next_fractal, image.width, image.height);
+	Image &image = job->image;
+	const bool panned = missing >= 0;
+	job->track_distance(wants_distance());
+	Rect<T> fractal = panned ? next_fractal : fix_aspect_ratio(next_fractal, image.width, image.height);
 
 	printf("running fractal of [%s,%s,%s,%s]\nto [%d,%d]\n", fptostr(fractal.x0).c_str(),
 	       fptostr(fractal.x1).c_str(), fptostr(fractal.y0).c_str(), fptostr(fractal.y1).c_str(), image.width,
 	       image.height);
 
-	prof.start();
-	prog_info.progress_num = 0;
-	prog_info.progress_den = image.height;
+	const int nthreads = worker_count();
 
-#if 1
-	const int nthreads = min(16, (int)thread::hardware_concurrency());
+	// a panned frame keeps the limit of the pixels it shifted in
+	view_extent = e<double>(fractal.x1 - fractal.x0);
+	if (auto_iterations && !panned) {
+		iteration_choice c = choose_iterations(view_extent, last_escapes);
+		max_iterations = c.n;
+		iterations_reason = std::move(c.reason);
+	}
 
-	calc_pool.join();
-	calc_pool.start(nthreads, (image.height + 1) / nthreads, [&image, fractal](int i) {
-		mandelbrot(image, 0, i, image.width, min(i + 1, image.height), fractal, max_iterations, palette);
-		prog_info.progress_num++;
-	});
-#else
-	mandelbrot(image, 0, 0, image.width, image.height, fractal, max_iterations, palette);
-	prog_info.progress_den = image.height;
+	job->progress.progress_den = panned ? missing : image.width * image.height;
+	job->marked = panned;
+	job->n = max_iterations;
+
+	// start from an earlier frame of the same view or one overlapping it. the cache keeps no distances, and
+	// those of a frame zoomed by another factor would not hold anyway
+	shared_ptr<Reuse> reuse;
+	{
+		Reuse r;
+		if (!panned && !image.distance)
+			r = views.plan(fractal, precision, max_iterations, image.width, image.height);
+		if (r.exact > 0) {
+			preview(image, r);
+			colorize_frame(image, max_iterations, palette, hist, coloring_workers, nthreads);
+			job->publish({0, 0, image.width, image.height});
+			job->progress.progress_den -= r.exact;
+			reuse = make_shared<Reuse>(std::move(r));
+		}
+	}
+	views.begin({fractal.x0, fractal.x1, fractal.y0, fractal.y1}, precision, max_iterations);
+
+	vector<Tile> tiles;
+	if ((!reuse || !reuse->complete()) && missing != 0)
+		tiles = make_tiles(image.width, image.height,
+		                   subdivide && !reuse && !panned ? subdivide_tile_size : tile_size, center_out);
+
+	shared_ptr<Reference<T>> ref;
+	if (perturbed && formula.formula == Formula::Mandelbrot)
+		ref = make_shared<Reference<T>>(fractal, max_iterations);
+#if LARGE_NUMBERS
+	reference = ref;
+#endif
+
+	// the palette may change while the frame renders, the frame is recolored when it is done
+	auto colors = make_shared<const Palette>(palette);
+
+	frame = job;
+	auto compute = [fractal, ref, reuse, panned, colors, n = max_iterations, split = subdivide,
+	                by_pass = progressive, params = formula](render_job &job, const Tile &t) {
+		Image &image = job.image;
+		tile_span span(image, t, (long long)job.generation, n);
+		auto render = [&image, &job, &span, &fractal, &ref, &params, n](
+		                      int left, int top, int right, int bottom, int xstep = 1, int ystep = 1) {
+#if LARGE_NUMBERS
+			if constexpr (has_reference<T>) {
+				if (ref) {
+					span.add(perturbation(image, left, top, right, bottom, *ref, xstep, ystep));
+					return;
+				}
+			}
 #endif
-	image.idx++;
+			with_formula(params, [&](const auto &step) {
+				span.add(mandelbrot(image, left, top, right, bottom, fractal, n, &job.shortcuts, xstep,
+				                    ystep, step));
+			});
+		};
+		// colors the tile and puts it on screen
+		auto paint = [&image, &job, &t, &colors, n] {
+			colorize(image, t.x0, t.y0, t.x1, t.y1, n, *colors);
+			job.publish(t);
+		};
+		auto &progress = job.progress.progress_num;
+
+		if (panned) {
+			progress += missing_tile(image, t, render);
+			paint();
+		} else if (reuse) {
+			progress += reuse_tile(t, *reuse, render);
+			paint();
+		} else if (by_pass) {
+			progress += progressive_pass(image, t, render);
+			span.counted = t.pass + 1 == progressive_passes;
+			paint();
+			// behind the other tiles, every tile finishes a pass before any starts the next
+			if (t.pass + 1 < progressive_passes) {
+				Tile next = t;
+				next.pass++;
+				service.push(next, false);
+			}
+		} else if (split) {
+			vector<Tile> quarters;
+			progress += mariani_silver(image, t, render, quarters);
+			span.counted = quarters.empty();
+			// the quarters cover the tile, its inside is not computed yet
+			if (quarters.empty())
+				paint();
+			for (const Tile &q : quarters)
+				service.push(q);
+		} else {
+			render(t.x0, t.y0, t.x1, t.y1);
+			paint();
+			progress += (t.x1 - t.x0) * (t.y1 - t.y0);
+		}
+	};
+	service.submit(job, nthreads, tiles, compute);
 
 	return {fractal.x0, fractal.x1, fractal.y0, fractal.y1};
 }
 
-template <typename T> Rect<fp> update_fractal(Image &image, const Rect<int> &d, const Rect<fp> &fractal)
+// a frame of width x height pixels, the drag rectangle d is in pixels of the frame on screen
+template <typename T>
+Rect<fp> update_fractal(int width, int height, const Rect<int> &d, const Rect<fp> &fractal, bool perturbed = false)
 {
 	Rect<T> next_fractal, old_fractal = collapse<T>(fractal);
 
-	if (drag.valid()) {
-		next_fractal.x0 = (old_fractal.x1 - old_fractal.x0) * d.x0 / image.width + old_fractal.x0;
-		next_fractal.x1 = (old_fractal.x1 - old_fractal.x0) * d.x1 / image.width + old_fractal.x0;
-		next_fractal.y0 = (old_fractal.y1 - old_fractal.y0) * d.y0 / image.height + old_fractal.y0;
-		next_fractal.y1 = (old_fractal.y1 - old_fractal.y0) * d.y1 / image.height + old_fractal.y0;
+	if (drag.valid() && frame) {
+		const int w = frame->image.width, h = frame->image.height;
+		next_fractal.x0 = (old_fractal.x1 - old_fractal.x0) * d.x0 / w + old_fractal.x0;
+		next_fractal.x1 = (old_fractal.x1 - old_fractal.x0) * d.x1 / w + old_fractal.x0;
+		next_fractal.y0 = (old_fractal.y1 - old_fractal.y0) * d.y0 / h + old_fractal.y0;
+		next_fractal.y1 = (old_fractal.y1 - old_fractal.y0) * d.y1 / h + old_fractal.y0;
 	} else {
 		next_fractal = old_fractal;
 	}
 
-	return update_fractal(image, next_fractal);
+	return update_fractal(service.make_job(width, height), next_fractal, perturbed);
 }
 
 Rect<fp> convert(const Rect<fp> &r, Precision newp, Precision oldp)
@@ -139,75 +346,235 @@ Rect<fp> convert(const Rect<fp> &r, Precision newp, Precision oldp)
 #if LARGE_NUMBERS
 	case Precision::Large:
 		return f(newp, collapse<float128>(r));
+	case Precision::Perturbation:
+		// in float128 or, deeper, in fixed256
+		return convert(r, newp, static_cast<Precision>(r.x0.index()));
+	case Precision::Fixed128:
+		return f(newp, collapse<fixed128>(r));
+	case Precision::Fixed192:
+		return f(newp, collapse<fixed192>(r));
+	case Precision::Fixed256:
+		return f(newp, collapse<fixed256>(r));
+	case Precision::DoubleDouble:
+		return f(newp, collapse<dd_real>(r));
+	case Precision::QuadDouble:
+		return f(newp, collapse<qd_real>(r));
 #endif
 	}
 	assert(false);
 	return {};
 }
 
-Rect<fp> invoke_fractal(Precision precision, Image &image, const Rect<int> &drag, const Rect<fp> fractal)
+// pixel spacing and largest coordinate of r on width x height pixels. the spacing is taken in the type of r,
+// in double the corners of a deep view are the same number.
+static void measure(const Rect<fp> &r, int width, int height, double &spacing, double &magnitude)
+{
+	std::visit(
+	    [&](const auto &x0) {
+		    using T = std::decay_t<decltype(x0)>;
+		    measure(collapse<T>(r), width, height, spacing, magnitude);
+	    },
+	    r.x0);
+}
+
+// measure() of the next frame of width x height pixels: r zoomed into the drag rectangle d like update_fractal()
+// does
+static void measure_next(const Rect<fp> &r, const Rect<int> &d, int width, int height, double &spacing,
+                         double &magnitude)
+{
+	measure(r, width, height, spacing, magnitude);
+	if (drag.valid() && frame) {
+		const Rect<int> n = d.normalize();
+		const Image &image = frame->image;
+		spacing *= min(double(n.x1 - n.x0) / image.width, double(n.y1 - n.y0) / image.height);
+	}
+}
+
+#if LARGE_NUMBERS
+// the type of a perturbation frame measure() found, fixed256 once float128 no longer resolves it
+static Precision perturbation_type(double spacing, double magnitude)
+{
+	return deep_perturbation(spacing, magnitude) ? Precision::Fixed256 : Precision::Large;
+}
+#endif
+
+// the view on screen goes on in precision p, its coordinates converted exactly
+static void set_precision(Precision p)
+{
+	if (static_cast<int>(p) == precision)
+		return;
+	fractal = convert(fractal, p, static_cast<Precision>(precision));
+	precision = static_cast<int>(p);
+}
+
+// the precision of the next frame of width x height pixels. in auto mode it first switches to the cheapest one
+// resolving that frame: the view on screen, zoomed into the drag rectangle like update_fractal() does.
+static Precision view_precision(int width, int height)
+{
+	if (auto_precision) {
+		double spacing, magnitude;
+		measure_next(fractal, drag, width, height, spacing, magnitude);
+		set_precision(choose_precision(spacing, magnitude));
+	}
+	return static_cast<Precision>(precision);
+}
+
+Rect<fp> invoke_fractal(Precision precision, int width, int height, const Rect<int> &drag, const Rect<fp> fractal)
 {
 	switch (precision) {
 	case Precision::Single:
-		return update_fractal<float>(image, drag, fractal);
+		return update_fractal<float>(width, height, drag, fractal);
 		break;
 	case Precision::Double:
-		return update_fractal<double>(image, drag, fractal);
+		return update_fractal<double>(width, height, drag, fractal);
 		break;
 #if LARGE_NUMBERS
 	case Precision::Large:
-		return update_fractal<float128>(image, drag, fractal);
+		return update_fractal<float128>(width, height, drag, fractal);
+		break;
+	case Precision::Fixed128:
+		return update_fractal<fixed128>(width, height, drag, fractal);
+		break;
+	case Precision::Fixed192:
+		return update_fractal<fixed192>(width, height, drag, fractal);
+		break;
+	case Precision::Fixed256:
+		return update_fractal<fixed256>(width, height, drag, fractal);
 		break;
+	case Precision::DoubleDouble:
+		return update_fractal<dd_real>(width, height, drag, fractal);
+		break;
+	case Precision::QuadDouble:
+		return update_fractal<qd_real>(width, height, drag, fractal);
+		break;
+	case Precision::Perturbation: {
+		double spacing, magnitude;
+		measure_next(fractal, drag, width, height, spacing, magnitude);
+		const Precision p = perturbation_type(spacing, magnitude);
+		const Rect<fp> r = convert(fractal, p, precision);
+		if (p == Precision::Fixed256)
+			return update_fractal<fixed256>(width, height, drag, r, true);
+		return update_fractal<float128>(width, height, drag, r, true);
+	}
 #endif
 	}
 	assert(false);
 	return {};
 }
 
+// moves the view by whole pixels, see shift()
+template <typename T> Rect<fp> pan_fractal(int dx, int dy, const Rect<fp> &fractal, bool perturbed = false)
+{
+	const Image &image = frame->image;
+	Rect<T> r = collapse<T>(fractal);
+	const T sx = (r.x1 - r.x0) / image.width;
+	const T sy = (r.y1 - r.y0) / image.height;
+	r.x0 = r.x0 + sx * T(dx);
+	r.x1 = r.x1 + sx * T(dx);
+	r.y0 = r.y0 + sy * T(dy);
+	r.y1 = r.y1 + sy * T(dy);
+
+	auto job = service.make_job(image.width, image.height);
+	// the pixels an unfinished frame did not reach yet are only known in a marked frame. a frame with
+	// distances has far tiles filled from their border, it only shifts into another one with distances.
+	job->track_distance(wants_distance());
+	if ((!frame->finished() && !frame->marked) || (job->image.distance != nullptr) != (image.distance != nullptr))
+		return update_fractal(job, r, perturbed);
+
+	// the kernels of the frame stop within cancel_interval iterations and leave the pixels they did not
+	// finish marked, only then the frame can be read
+	service.cancel();
+	service.settle(frame);
+	long long missing = shift(image, job->image, dx, dy);
+	job->publish({0, 0, image.width, image.height});
+	return update_fractal(job, r, perturbed, missing);
+}
+
+Rect<fp> invoke_pan(Precision precision, int dx, int dy, const Rect<fp> fractal)
+{
+	switch (precision) {
+	case Precision::Single:
+		return pan_fractal<float>(dx, dy, fractal);
+	case Precision::Double:
+		return pan_fractal<double>(dx, dy, fractal);
+#if LARGE_NUMBERS
+	case Precision::Large:
+		return pan_fractal<float128>(dx, dy, fractal);
+	case Precision::Fixed128:
+		return pan_fractal<fixed128>(dx, dy, fractal);
+	case Precision::Fixed192:
+		return pan_fractal<fixed192>(dx, dy, fractal);
+	case Precision::Fixed256:
+		return pan_fractal<fixed256>(dx, dy, fractal);
+	case Precision::DoubleDouble:
+		return pan_fractal<dd_real>(dx, dy, fractal);
+	case Precision::QuadDouble:
+		return pan_fractal<qd_real>(dx, dy, fractal);
+	case Precision::Perturbation: {
+		double spacing, magnitude;
+		measure(fractal, frame->image.width, frame->image.height, spacing, magnitude);
+		const Precision p = perturbation_type(spacing, magnitude);
+		const Rect<fp> r = convert(fractal, p, precision);
+		if (p == Precision::Fixed256)
+			return pan_fractal<fixed256>(dx, dy, r, true);
+		return pan_fractal<float128>(dx, dy, r, true);
+	}
+#endif
+	}
+	assert(false);
+	return {};
+}
+
+// the zoom history and the current view as keyframes of fractal_zoom
+static void save_zoom_path(const char *path)
+{
+	FILE *f = fopen(path, "w");
+	if (!f)
+		return;
+	auto put = [f](const Rect<fp> &r) {
+		fprintf(f, "%s %s %s %s\n", fptostr(r.x0).c_str(), fptostr(r.x1).c_str(), fptostr(r.y0).c_str(),
+		        fptostr(r.y1).c_str());
+	};
+	for (const Rect<fp> &r : zoom_history)
+		put(r);
+	put(fractal);
+	fclose(f);
+}
+
 void key(GLFWwindow *window, int key, int scancode, int action, int flags)
 {
 	constexpr int move_offset = 100;
-	Rect<int> move{-1, -1, -1, -1};
 
 	// esc
 	if (key == 256 && scancode == 1) {
 		if (action == GLFW_PRESS)
 			glfwSetWindowShouldClose(window, true);
-	}
-#if 0
-	// down
-	else if (key == 264 && scancode == 336) {
-		printf("down\n");
-		move.x0 = 0;
-		move.y0 = move_offset;
-		move.x1 = image.width;
-		move.y1 = image.height + move_offset;
-	}
-	// up
-	else if (key == 265 && scancode == 328) {
-		printf("up\n");
-		move.x0 = 0;
-		move.y0 = -move_offset;
-		move.x1 = image.width;
-		move.y1 = image.height - move_offset;
-	}
-	// left
-	else if (key == 263 && scancode == 331) {
-		printf("left\n");
-	}
-	// eight
-	else if (key == 262 && scancode == 333) {
-		printf("right\b");
-	} else {
-		printf("unknown key %d %d %d %d\n", key, scancode, action, flags);
+		return;
 	}
 
-	if (move.valid())
-	{
-		fractal = invoke_fractal(static_cast<Precision>(precision), image, move, fractal);
-		glfwPostEmptyEvent();
+	if (action == GLFW_RELEASE || ImGui::GetIO().WantCaptureKeyboard)
+		return;
+
+	int dx = 0, dy = 0;
+	switch (key) {
+	case GLFW_KEY_DOWN:
+		dy = -move_offset;
+		break;
+	case GLFW_KEY_UP:
+		dy = move_offset;
+		break;
+	case GLFW_KEY_LEFT:
+		dx = -move_offset;
+		break;
+	case GLFW_KEY_RIGHT:
+		dx = move_offset;
+		break;
+	default:
+		return;
 	}
-#endif
+
+	fractal = invoke_pan(static_cast<Precision>(precision), dx, dy, fractal);
+	glfwPostEmptyEvent();
 }
 
 void mouse(GLFWwindow *window, int button, int state, int flags)
@@ -235,12 +602,28 @@ void mouse(GLFWwindow *window, int button, int state, int flags)
 			}
 		}
 		break;
+	case GLFW_MOUSE_BUTTON_RIGHT:
+		is_panning = state == GLFW_PRESS;
+		if (is_panning)
+			glfwGetCursorPos(window, &pan_x, &pan_y);
+		break;
 	}
 	glfwPostEmptyEvent();
 }
 
 void motion(GLFWwindow *window, double raw_x, double raw_y)
 {
+	if (is_panning) {
+		// the frame follows the cursor, window y points down
+		int dx = static_cast<int>(raw_x - pan_x);
+		int dy = static_cast<int>(raw_y - pan_y);
+		if (dx || dy) {
+			pan_x += dx;
+			pan_y += dy;
+			fractal = invoke_pan(static_cast<Precision>(precision), -dx, dy, fractal);
+		}
+	}
+
 	if (is_dragging) {
 		int x = static_cast<int>(raw_x);
 		int y = static_cast<int>(raw_y);
@@ -264,31 +647,16 @@ void motion(GLFWwindow *window, double raw_x, double raw_y)
 	}
 }
 
-void update_texture(const Image &image)
-{
-	glEnable(GL_TEXTURE_2D);
-	glBindTexture(GL_TEXTURE_2D, tex);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, image.width, image.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image.buf);
-	glDisable(GL_TEXTURE_2D);
-}
-
 void display(GLFWwindow *window)
 {
 	int width;
 	int height;
 	glfwGetFramebufferSize(window, &width, &height);
 
-	if (image.width != width || image.height != height) {
-		if (!image.buf || width * height * 4 > image.buf_size) {
-			delete[] image.buf;
-			image.buf_size = width * height * 4;
-			image.buf = new uint8_t[image.buf_size];
-		}
-
-		image.width = width;
-		image.height = height;
-
-		fractal = invoke_fractal(static_cast<Precision>(precision), image, drag.normalize(), fractal);
+	// the frame still running keeps its own buffers until its tiles are gone
+	if (frame->image.width != width || frame->image.height != height) {
+		const Precision p = view_precision(width, height);
+		fractal = invoke_fractal(p, width, height, drag.normalize(), fractal);
 	}
 
 	glViewport(0, 0, width, height);
@@ -303,7 +671,7 @@ void display(GLFWwindow *window)
 	glClear(GL_COLOR_BUFFER_BIT);
 
 	glEnable(GL_TEXTURE_2D);
-	glBindTexture(GL_TEXTURE_2D, tex);
+	glBindTexture(GL_TEXTURE_2D, stream.texture());
 	glBegin(GL_QUADS);
 	glTexCoord2f(0, 0);
 	glVertex2i(1, 1);
@@ -316,6 +684,28 @@ void display(GLFWwindow *window)
 	glEnd();
 	glDisable(GL_TEXTURE_2D);
 
+	if (show_heatmap && heat.peak > 0) {
+		// blue for the cheapest cells to red for the most expensive one
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		glBegin(GL_QUADS);
+		for (int cy = 0; cy < heat.rows; ++cy) {
+			for (int cx = 0; cx < heat.columns; ++cx) {
+				const float t = float(heat.cost[cy * heat.columns + cx] / heat.peak);
+				const int x0 = cx * heatmap_cell + 1, y0 = cy * heatmap_cell + 1;
+				const int x1 = min(x0 + heatmap_cell, width + 1);
+				const int y1 = min(y0 + heatmap_cell, height + 1);
+				glColor4f(t, 0, 1 - t, 0.45f);
+				glVertex2i(x0, y0);
+				glVertex2i(x0, y1);
+				glVertex2i(x1, y1);
+				glVertex2i(x1, y0);
+			}
+		}
+		glEnd();
+		glDisable(GL_BLEND);
+	}
+
 	if (drag.valid()) {
 		glColor3f(1, 1, 1);
 		glBegin(GL_LINE_LOOP);
@@ -347,7 +737,8 @@ void draw_ui(GLFWwindow *window)
 
 			zoom_history.push_back(fractal);
 
-			fractal = invoke_fractal(static_cast<Precision>(precision), image, drag.normalize(), fractal);
+			const Precision p = view_precision(frame->image.width, frame->image.height);
+			fractal = invoke_fractal(p, frame->image.width, frame->image.height, drag.normalize(), fractal);
 
 			drag.x0 = drag.y0 = drag.x1 = drag.y1 = -1;
 		}
@@ -360,44 +751,114 @@ void draw_ui(GLFWwindow *window)
 	if (Button("zoom out")) {
 		if (!zoom_history.empty()) {
 			Rect<fp> prev = zoom_history.back();
-			fractal = invoke_fractal(
-			    static_cast<Precision>(precision), image, drag.normalize(),
-			    convert(prev, static_cast<Precision>(precision), static_cast<Precision>(prev.x0.index())));
+			const Precision from = static_cast<Precision>(prev.x0.index());
+			if (auto_precision) {
+				double spacing, magnitude;
+				measure(prev, frame->image.width, frame->image.height, spacing, magnitude);
+				set_precision(choose_precision(spacing, magnitude));
+			}
+			const Precision p = static_cast<Precision>(precision);
+			fractal = invoke_fractal(p, frame->image.width, frame->image.height, drag.normalize(),
+			                         convert(prev, p, from));
 			zoom_history.pop_back();
 		}
 	}
 
+	if (Button("save zoom path"))
+		save_zoom_path("zoom_path.txt");
+
 	if (Button("update")) {
-		fractal = invoke_fractal(static_cast<Precision>(precision), image, drag, fractal);
+		const Precision p = view_precision(frame->image.width, frame->image.height);
+		fractal = invoke_fractal(p, frame->image.width, frame->image.height, drag, fractal);
 	}
 
 	const char *items =
 #if LARGE_NUMBERS
-	    "single\0double\0large\0"
+	    "single\0double\0large\0fixed 128\0fixed 192\0fixed 256\0double-double\0quad-double\0perturbation\0"
 #else
 	    "single\0double\0"
 #endif
 	    ;
 
+	// picking one by hand turns the automatic choice off
 	int new_precision = precision;
 	if (Combo("Precision", &new_precision, items)) {
-		if (new_precision != precision) {
-			fractal =
-			    convert(fractal, static_cast<Precision>(new_precision), static_cast<Precision>(precision));
-			precision = new_precision;
-		}
+		set_precision(static_cast<Precision>(new_precision));
+		auto_precision = false;
+	}
+	SameLine();
+	Checkbox("auto##precision", &auto_precision);
+
+	// editing the limit turns the automatic one off
+	if (InputInt("Iterations", &max_iterations))
+		auto_iterations = false;
+	SameLine();
+	Checkbox("auto##iterations", &auto_iterations);
+	if (auto_iterations)
+		Text("%s", iterations_reason.c_str());
+
+	// the cached frames are of the formula before, a change computes the view again
+	bool new_formula = false;
+	int formula_index = static_cast<int>(formula.formula);
+	if (Combo("formula", &formula_index, "mandelbrot\0julia\0burning ship\0multibrot\0")) {
+		formula.formula = static_cast<Formula>(formula_index);
+		new_formula = true;
+	}
+	if (formula.formula == Formula::Julia) {
+		new_formula |= InputDouble("c real", &formula.cx, 0.01, 0.1, "%.6f");
+		new_formula |= InputDouble("c imag", &formula.cy, 0.01, 0.1, "%.6f");
+	}
+	if (formula.formula == Formula::Multibrot)
+		new_formula |= SliderInt("degree", &formula.degree, multibrot_min_degree, multibrot_max_degree);
+	if (new_formula) {
+		views.clear();
+		const Precision p = view_precision(frame->image.width, frame->image.height);
+		fractal = invoke_fractal(p, frame->image.width, frame->image.height, drag, fractal);
 	}
 
-	if (InputInt("Iterations", &max_iterations)) {
+	Checkbox("center first", &center_out);
+	Checkbox("skip uniform tiles", &subdivide);
+	Checkbox("progressive", &progressive);
+	int coloring = static_cast<int>(palette.coloring);
+	if (Combo("coloring", &coloring, "bands\0smooth\0histogram\0distance\0")) {
+		palette.coloring = static_cast<Coloring>(coloring);
+		recolor = true;
+		// the distances are only estimated for that coloring, the frame is computed again to switch
+		if (wants_distance() != (frame->image.distance != nullptr)) {
+			const Precision p = view_precision(frame->image.width, frame->image.height);
+			fractal = invoke_fractal(p, frame->image.width, frame->image.height, drag, fractal);
+		}
 	}
+	if (SliderInt("palette offset", &palette.offset, 0, (int)palette_size - 1))
+		recolor = true;
+	Checkbox("cycle colors", &cycle_colors);
+	if (Checkbox("trace", &tracing))
+		trace::enable(tracing);
+	SameLine();
+	Checkbox("heatmap", &show_heatmap);
+	SameLine();
+	if (Button("save trace"))
+		trace::write_chrome("trace.json");
 
 	Separator();
 
 	// Text("progress %d%%", prog_info.progress_num * 100 / prog_info.progress_den);
+	const progress_info &prog_info = frame->progress;
 	char str[256];
-	snprintf(str, sizeof(str), "progress %d%%", prog_info.progress_num * 100 / prog_info.progress_den);
+	snprintf(str, sizeof(str), "progress %d%%", int(prog_info.progress_num * 100.0 / prog_info.progress_den));
 	ProgressBar((float)prog_info.progress_num / prog_info.progress_den, {0, 0}, str);
-	Text("last execution time %.4lf sec", prog_info.execution_time_sec);
+	Text("last execution time %.4lf sec", execution_time_sec);
+#if LARGE_NUMBERS
+	if (precision == static_cast<int>(Precision::Perturbation) && reference)
+		Text("series skipped %d, glitches %d, references %d", reference->skip, reference->glitches.load(),
+		     reference->references.load());
+#endif
+	const Shortcuts &shortcuts = frame->shortcuts;
+	Text("interior: cardioid %lld, bulb %lld, cycles %lld", shortcuts.cardioid.load(), shortcuts.bulb.load(),
+	     shortcuts.periodic.load());
+	if (heat.tiles)
+		Text("tiles %d, slowest %.2f ms, mean %.2f ms, interior %.1f%%, %.1f Miter/s", heat.tiles,
+		     heat.slowest_ms, heat.mean_ms, heat.interior, heat.miter_per_sec);
 
 	double v = 0;
 	for (int i = 0; i < smoothed_n; ++i)
@@ -422,23 +883,21 @@ void draw_ui(GLFWwindow *window)
 
 int main(int argc, char **argv)
 {
-	image.width = 1280;
-	image.height = 720;
-	image.buf_size = image.width * image.height * 4;
-	image.buf = new uint8_t[image.buf_size];
+	const int width = 1280;
+	const int height = 720;
 
-	const float ar = float(image.width) / float(image.height);
+	const float ar = float(width) / float(height);
 	const float scale = 0.004f;
-	fractal.x0 = -image.width / 2 * scale;
-	fractal.x1 = +image.width / 2 * scale;
-	fractal.y0 = -image.width / ar / 2 * scale;
-	fractal.y1 = +image.width / ar / 2 * scale;
+	fractal.x0 = -width / 2 * scale;
+	fractal.x1 = +width / 2 * scale;
+	fractal.y0 = -width / ar / 2 * scale;
+	fractal.y1 = +width / ar / 2 * scale;
 
 	glfwSetErrorCallback(glfw_error_callback);
 	if (!glfwInit())
 		return 1;
 
-	GLFWwindow *window = glfwCreateWindow(image.width, image.height, "fractale", nullptr, nullptr);
+	GLFWwindow *window = glfwCreateWindow(width, height, "fractale", nullptr, nullptr);
 	if (!window)
 		return 1;
 	glfwMakeContextCurrent(window);
@@ -461,20 +920,14 @@ int main(int argc, char **argv)
 
 	io.FontDefault = io.Fonts->AddFontDefault();
 
-	glGenTextures(1, &tex);
-	glEnable(GL_TEXTURE_2D);
-	glBindTexture(GL_TEXTURE_2D, tex);
-	glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glDisable(GL_TEXTURE_2D);
+	stream.init();
 
-	fractal = invoke_fractal(static_cast<Precision>(precision), image, Rect<int>{0, 0, image.width, image.height},
-	                         fractal);
+	const Precision p = view_precision(width, height);
+	fractal = invoke_fractal(p, width, height, Rect<int>{0, 0, width, height}, fractal);
 
 	double prev_time = Profiler::get();
 	int smoothed_i = 0;
-	int prev_image_idx = -1;
+	uint64_t finished_generation = 0;
 
 	while (!glfwWindowShouldClose(window)) {
 		glfwPollEvents();
@@ -486,13 +939,41 @@ int main(int argc, char **argv)
 
 		ImGui::Render();
 
-		if (calc_pool.is_finished() && image.idx != prev_image_idx) {
-			update_texture(image);
-			calc_pool.join();
-			prog_info.execution_time_sec = prof.elapsed_time();
-			prev_image_idx = image.idx;
+		if (frame->finished() && frame->generation != finished_generation) {
+			// far tiles of a frame with distances are filled from their border, only fit for that coloring
+			if (!frame->image.distance)
+				views.finish(frame->image);
+			execution_time_sec = frame->progress.execution_time_sec;
+			finished_generation = frame->generation;
+			last_escapes = count_escapes(frame->image, frame->n);
+			if (tracing)
+				build_heatmap(*frame);
+			// the tiles were colored smooth, the ranks are only known now
+			if (palette.coloring == Coloring::Histogram)
+				recolor = true;
+		}
+
+		// while pixels still escape near the limit the view is computed again with a higher one. not while a
+		// selection is dragged, the frame would zoom into it.
+		if (auto_iterations && frame->finished() && !drag.valid() &&
+		    choose_iterations(view_extent, last_escapes).n > frame->n) {
+			const Precision p = view_precision(frame->image.width, frame->image.height);
+			fractal = invoke_fractal(p, frame->image.width, frame->image.height, drag, fractal);
+		}
+
+		if (cycle_colors) {
+			palette.offset = (palette.offset + 1) % (int)palette_size;
+			recolor = true;
+		}
+		if (recolor && frame->finished()) {
+			colorize_frame(frame->image, frame->n, palette, hist, coloring_workers, worker_count());
+			frame->publish({0, 0, frame->image.width, frame->image.height});
+			recolor = false;
 		}
 
+		// the tiles finished since the last frame, coarse passes show while the finer ones still run
+		stream.upload(*frame);
+
 		display(window);
 
 		ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
@@ -513,9 +994,8 @@ int main(int argc, char **argv)
 	glfwDestroyWindow(window);
 	glfwTerminate();
 
-	calc_pool.join();
-
-	delete[] image.buf;
+	service.cancel();
+	frame.reset();
 
 	return 0;
 }
@@ -1,72 +1,317 @@
 #include <stdint.h>
+#include <algorithm>
+#include <type_traits>
 #include "mandelbrot.h"
+#include "simd.h"
 
-template <typename T>
-int mandelbrot(Image &image, int left, int top, int width, int height, const Rect<T> &r, int n, const Palette &palette)
+// interior points never escape, so every one that is caught early saves max_iterations iterations:
+// the main cardioid and the period 2 bulb are tested in closed form before iterating, attracting cycles
+// are found by comparing z against the value saved at the last power of two iteration (Brent).
+
+// z within this fraction of the pixel spacing of the saved value counts as a cycle
+constexpr int periodicity_fraction = 1024;
+
+// 1 inside the main cardioid, 2 inside the period 2 bulb, else 0
+template <typename T> static int interior(const T &x, const T &y, const T &quarter, const T &sixteenth)
+{
+	const T y2 = sqr(y);
+	const T xq = x - quarter;
+	const T q = sqr(xq) + y2;
+	if (q * (q + xq) < y2 * quarter)
+		return 1;
+	const T x1 = x + 1;
+	if (sqr(x1) + y2 < sixteenth)
+		return 2;
+	return 0;
+}
+
+static void count_shortcuts(Shortcuts *shortcuts, long long cardioid, long long bulb, long long periodic)
+{
+	if (!shortcuts)
+		return;
+	if (cardioid)
+		shortcuts->cardioid += cardioid;
+	if (bulb)
+		shortcuts->bulb += bulb;
+	if (periodic)
+		shortcuts->periodic += periodic;
+}
+
+#if SIMD_LANES
+// iterates V::width horizontally adjacent pixels together. lanes that escaped stop counting but keep
+// iterating until every lane is done, the row tail is computed in full and only the valid lanes stored.
+// estimate also iterates dz/dc for the distance estimate, a separate instance so the plain loop stays as it is.
+template <typename V, bool estimate, typename T, typename F>
+static long long mandelbrot_lanes(Image &image, int left, int top, int width, int height, const Rect<T> &r, int n,
+                                  Shortcuts *shortcuts, int xstep, int ystep, const F &formula)
+{
+	constexpr int w = V::width;
+	const V max_radius = V::set1(2 * 2);
+	const T sx = (r.x1 - r.x0) / image.width;
+	const double spacing = e<double>(sx);
+	const V scalex = V::set1(sx);
+	const V x0 = V::set1(r.x0);
+	const V offset = V::iota(0) * V::set1(T(xstep));
+	const T scaley = (r.y1 - r.y0) / image.height;
+	const T eps = std::min(sx, scaley) / periodicity_fraction;
+	const V eps2 = V::set1(eps * eps);
+	const V one = V::set1(1);
+	const V two = V::set1(2);
+	const V quarter = V::set1(T(1) / 4);
+	const V sixteenth = V::set1(T(1) / 16);
+	// c of a julia set
+	V fixed_u = V::set1(0), fixed_v = V::set1(0);
+	if constexpr (F::fixed_c) {
+		fixed_u = V::set1(T(formula.cx));
+		fixed_v = V::set1(T(formula.cy));
+	}
+	long long cardioid = 0, bulb = 0, periodic = 0, iterations = 0;
+	const bool keep_r2 = estimate || image.r2 != nullptr;
+	int count[w];
+	float escape[w];
+	// z, dz/dc and c of the lanes for the distance estimate, in double like the scalar loop: dz/dc outgrows
+	// float on deep views
+	double zu[w], zv[w], slope_u[w], slope_v[w], point_u[w];
+	double point_v = 0;
+
+	for (int y = top; y < height && !cancelled(image); y += ystep) {
+		const V v0 = V::set1(T(y) * scaley + r.y0);
+		const V y2 = sqr(v0);
+
+		for (int x = left; x < width; x += w * xstep) {
+			const V u0 = (offset + V::set1(T(x))) * scalex + x0;
+			V u = V::set1(0), v = V::set1(0), it = V::set1(0);
+			typename V::mask alive = lt(u, max_radius);
+			V cu = u0, cv = v0;
+			if constexpr (F::fixed_c) {
+				u = u0;
+				v = v0;
+				cu = fixed_u;
+				cv = fixed_v;
+			}
+
+			typename V::mask in_cardioid = but(alive, alive), in_bulb = in_cardioid;
+			if constexpr (F::interior) {
+				const V xq = u0 - quarter;
+				const V q = sqr(xq) + y2;
+				in_cardioid = lt(q * (q + xq), y2 * quarter);
+				in_bulb = lt(sqr(u0 + one) + y2, sixteenth);
+			}
+			const typename V::mask inside = either(in_cardioid, in_bulb);
+			// empty mask
+			typename V::mask cycle = but(inside, inside);
+			alive = but(alive, inside);
+
+			V su = u, sv = v, r2 = V::set1(0);
+			// dz/dc, and z and dz/dc of the lanes escaping now
+			V du_dc = r2, dv_dc = r2, eu = r2, ev = r2, edu = r2, edv = r2;
+			long long check = 1;
+			for (int i = 0; i < n; ++i) {
+				V uu = sqr(u);
+				V vv = sqr(v);
+				V uv2 = uu + vv;
+				// |z|^2 of the lanes escaping now
+				if (keep_r2)
+					r2 = select(alive, uv2, r2);
+				if constexpr (estimate) {
+					eu = select(alive, u, eu);
+					ev = select(alive, v, ev);
+					edu = select(alive, du_dc, edu);
+					edv = select(alive, dv_dc, edv);
+				}
+				alive = both(alive, lt(uv2, max_radius));
+				if (!any(alive))
+					break;
+				if ((i & (cancel_interval - 1)) == cancel_interval - 1 && cancelled(image)) {
+					count_shortcuts(shortcuts, cardioid, bulb, periodic);
+					return iterations;
+				}
+				it = inc(it, alive);
+				if constexpr (estimate) {
+					// dz/dc' = 2 z dz/dc + 1
+					const V du = two * (u * du_dc - v * dv_dc) + one;
+					dv_dc = two * (u * dv_dc + v * du_dc);
+					du_dc = du;
+				}
+				F::step(u, v, uu, vv, cu, cv);
+
+				V du = u - su, dv = v - sv;
+				typename V::mask found = both(alive, lt(sqr(du) + sqr(dv), eps2));
+				if (any(found)) {
+					cycle = either(cycle, found);
+					alive = but(alive, found);
+				}
+				if (i + 1 == check) {
+					su = u;
+					sv = v;
+					check += check;
+				}
+			}
+
+			const int m = std::min(w, (width - x + xstep - 1) / xstep);
+			const int valid = (1 << m) - 1;
+			const int card_bits = bits(in_cardioid) & valid;
+			const int bulb_bits = bits(in_bulb) & ~card_bits & valid;
+			const int cycle_bits = bits(cycle) & valid;
+			cardioid += __builtin_popcount(card_bits);
+			bulb += __builtin_popcount(bulb_bits);
+			periodic += __builtin_popcount(cycle_bits);
+
+			store(count, it);
+			store(escape, r2);
+			if constexpr (estimate) {
+				store(zu, eu);
+				store(zv, ev);
+				store(slope_u, edu);
+				store(slope_v, edv);
+				store(point_u, u0);
+				point_v = e<double>(T(y) * scaley + r.y0);
+			}
+			const int done = card_bits | bulb_bits | cycle_bits;
+			for (int k = 0; k < m; ++k) {
+				iterations += count[k];
+				const int i = done >> k & 1 ? n : count[k];
+				plot(image, x + k * xstep + y * image.width, i, n, escape[k]);
+				if constexpr (estimate)
+					plot_distance(image, x + k * xstep + y * image.width, i, n, zu[k], zv[k],
+					              slope_u[k], slope_v[k], point_u[k], point_v, spacing);
+			}
+		}
+	}
+	count_shortcuts(shortcuts, cardioid, bulb, periodic);
+	return iterations;
+}
+#endif
+
+template <typename T, typename F>
+long long mandelbrot(Image &image, int left, int top, int width, int height, const Rect<T> &r, int n,
+                     Shortcuts *shortcuts, int xstep, int ystep, const F &formula)
 {
+#if SIMD_LANES
+	using V = typename lanes<T>::type;
+	// float lanes count iterations in float, exact only up to 2^24
+	if constexpr (!std::is_void_v<V>) {
+		if (n < (1 << 24)) {
+			if constexpr (F::derivative) {
+				if (image.distance)
+					return mandelbrot_lanes<V, true>(image, left, top, width, height, r, n,
+					                                 shortcuts, xstep, ystep, formula);
+			}
+			return mandelbrot_lanes<V, false>(image, left, top, width, height, r, n, shortcuts, xstep,
+			                                  ystep, formula);
+		}
+	}
+#endif
+
 	const T max_radius = 2 * 2;
 	const T scalex = (r.x1 - r.x0) / image.width;
 	const T scaley = (r.y1 - r.y0) / image.height;
-	uint32_t *pixels = reinterpret_cast<uint32_t *>(image.buf);
+	const T eps = std::min(scalex, scaley) / periodicity_fraction;
+	const T neg_eps = -eps;
+	const T quarter = T(1) / 4;
+	const T sixteenth = T(1) / 16;
+	// c of a julia set
+	T fixed_u = 0, fixed_v = 0;
+	if constexpr (F::fixed_c) {
+		fixed_u = T(formula.cx);
+		fixed_v = T(formula.cy);
+	}
+	long long cardioid = 0, bulb = 0, periodic = 0, iterations = 0;
+	const bool estimate = F::derivative && image.distance != nullptr;
+	const double spacing = e<double>(scalex);
 
-	for (int y = top; y < height; ++y) {
-		for (int x = left; x < width; ++x) {
+	for (int y = top; y < height && !cancelled(image); y += ystep) {
+		for (int x = left; x < width; x += xstep) {
 			const T u0 = T(x) * scalex + r.x0;
 			const T v0 = T(y) * scaley + r.y0;
 
-#if 1
-			T u = 0, v = 0;
-
-			int i = 0;
-			while (u * u + v * v < max_radius && i < n) {
-				T nextu = u * u - v * v + u0;
-				v = 2 * u * v + v0;
-				u = nextu;
-				i++;
-			}
-#elif 0
-			const T cu = 0.35, cv = 0.35;
-			T u = u0, v = v0;
-
-			int i = 0;
-			while (u * u + v * v < max_radius && i < n) {
-				T nextu = u * u - v * v + cu;
-				v = 2 * u * v + cv;
-				u = nextu;
-				i++;
+			// squares are kept for the next escape test, that matters for the multi precision types
+			T u = 0, v = 0, uu = 0, vv = 0;
+			T cu = u0, cv = v0;
+			if constexpr (F::fixed_c) {
+				u = u0;
+				v = v0;
+				uu = sqr(u);
+				vv = sqr(v);
+				cu = fixed_u;
+				cv = fixed_v;
 			}
-#else
-			T u = u0, v = v0;
-
-			int i = 0;
-			while (u * u + v * v < max_radius && i < n) {
-				T nextu = u * u - v * v + u0;
-				v = abs(2 * u * v) + v0;
-				u = nextu;
-				i++;
+
+			int i = 0, first = 0;
+			bool cycle = false;
+			if constexpr (F::interior) {
+				if (int inside = interior(u0, v0, quarter, sixteenth)) {
+					i = first = n;
+					(inside == 1 ? cardioid : bulb)++;
+				}
 			}
 
-#endif
+			// the comparison only subtracts, it has to stay cheap next to the multiplications
+			T su = 0, sv = 0;
+			long long check = 1;
+			// dz/dc for the distance estimate, in double: it outgrows the range of the fixed point types
+			double du_dc = 0, dv_dc = 0;
+			while (uu + vv < max_radius && i < n) {
+				if (estimate) {
+					const double zu = e<double>(u), zv = e<double>(v);
+					const double du = 2 * (zu * du_dc - zv * dv_dc) + 1;
+					dv_dc = 2 * (zu * dv_dc + zv * du_dc);
+					du_dc = du;
+				}
+				F::step(u, v, uu, vv, cu, cv);
+				uu = sqr(u);
+				vv = sqr(v);
+				i++;
+				if ((i & (cancel_interval - 1)) == 0 && cancelled(image)) {
+					count_shortcuts(shortcuts, cardioid, bulb, periodic);
+					return iterations + i;
+				}
 
-			int idx = x + y * image.width;
-			if (i == n)
-				pixels[idx] = 0;
-			else {
-				int row = i & 3;
-				pixels[idx] = palette.color[row][i / 4 % palette_size];
+				T du = u - su, dv = v - sv;
+				if (du < eps && neg_eps < du && dv < eps && neg_eps < dv) {
+					cycle = true;
+					periodic++;
+					break;
+				}
+				if (i == check) {
+					su = u;
+					sv = v;
+					check += check;
+				}
 			}
+			iterations += i - first;
+			if (cycle)
+				i = n;
+
+			plot(image, x + y * image.width, i, n, e<double>(uu + vv));
+			if (estimate)
+				plot_distance(image, x + y * image.width, i, n, e<double>(u), e<double>(v), du_dc,
+				              dv_dc, e<double>(u0), e<double>(v0), spacing);
 		}
 	}
-	return 0;
+	count_shortcuts(shortcuts, cardioid, bulb, periodic);
+	return iterations;
 }
 
-template int mandelbrot<float>(Image &image, int left, int top, int width, int height, const Rect<float> &r, int n,
-                               const Palette &palette);
-
-template int mandelbrot<double>(Image &image, int left, int top, int width, int height, const Rect<double> &r, int n,
-                                const Palette &palette);
+// every formula for every precision
+#define INSTANTIATE_STEP(T, F)                                                                                         \
+	template long long mandelbrot<T, F>(Image &, int, int, int, int, const Rect<T> &, int, Shortcuts *, int, int,  \
+	                                    const F &);
+#define INSTANTIATE(T)                                                                                                 \
+	INSTANTIATE_STEP(T, mandelbrot_step)                                                                           \
+	INSTANTIATE_STEP(T, julia_step)                                                                                \
+	INSTANTIATE_STEP(T, burning_ship_step)                                                                         \
+	INSTANTIATE_STEP(T, multibrot_step<3>)                                                                         \
+	INSTANTIATE_STEP(T, multibrot_step<4>)                                                                         \
+	INSTANTIATE_STEP(T, multibrot_step<5>)
 
+INSTANTIATE(float)
+INSTANTIATE(double)
 #if LARGE_NUMBERS
-template int mandelbrot<float128>(Image &image, int left, int top, int width, int height, const Rect<float128> &r,
-                                  int n, const Palette &palette);
+INSTANTIATE(float128)
+INSTANTIATE(fixed128)
+INSTANTIATE(fixed192)
+INSTANTIATE(fixed256)
+INSTANTIATE(dd_real)
+INSTANTIATE(qd_real)
 #endif
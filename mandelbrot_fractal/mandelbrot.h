@@ -1,7 +1,12 @@
 #pragma once
+#include <algorithm>
+#include <atomic>
 #include <variant>
 #include <string>
 #include <assert.h>
+#include <math.h>
+#include <string.h>
+#include <type_traits>
 
 #if !defined(LARGE_NUMBERS)
 #define LARGE_NUMBERS 1
@@ -18,13 +23,23 @@ using float128 = boost::multiprecision::number<boost::multiprecision::cpp_bin_fl
 using float128 = boost::multiprecision::float128;
 #endif
 
-using fp = std::variant<float, double, float128>;
+#include "large_number.h"
+#include "multi_double.h"
+
+// fixed point tiers, 16 integer bits leave room for |z|^2 of points far outside the set
+using fixed128 = LargeNumber<2, 16>;
+using fixed192 = LargeNumber<3, 16>;
+using fixed256 = LargeNumber<4, 16>;
+
+using fp = std::variant<float, double, float128, fixed128, fixed192, fixed256, dd_real, qd_real>;
 
 #else
 using fp = std::variant<float, double>;
 #endif
 
+#include "formula.h"
 #include "palette.h"
+#include "simd.h"
 
 template <typename T> struct Rect {
 	T x0;
@@ -44,11 +59,177 @@ template <typename T> struct Rect {
 struct Image {
 	uint8_t *buf = nullptr;
 	size_t buf_size = 0;
+	// escape iteration of every pixel, max_iterations inside the set
+	int *iter = nullptr;
+	// |z|^2 of every pixel right after it escaped, 0 inside the set. optional, escape_fraction() turns it
+	// into the fractional part of the escape iteration
+	float *r2 = nullptr;
+	// estimated distance of every pixel to the set in pixels, 0 inside the set. optional, the kernels only
+	// iterate the derivative dz/dc it takes when the image has the buffer, and only for mandelbrot_step
+	float *distance = nullptr;
 	int width = 0;
 	int height = 0;
 	int idx = 0;
+	// set once the job writing the image was abandoned, the kernels give up on it, see cancelled()
+	const std::atomic<bool> *cancel = nullptr;
 };
 
+// iterations between two looks at the cancel flag of the image, a power of two
+constexpr int cancel_interval = 4096;
+
+// the kernels stop without storing the pixel they were at, the pixels they did not reach keep their values
+inline bool cancelled(const Image &image) { return image.cancel && image.cancel->load(std::memory_order_relaxed); }
+
+// log2 of a positive normal float to 2e-5, close enough to pick colors and several times faster than log2f
+inline float fast_log2(float a)
+{
+	uint32_t bits;
+	memcpy(&bits, &a, sizeof(bits));
+	const float e = float(int(bits >> 23) - 127);
+	bits = (bits & 0x7fffff) | 0x3f800000;
+	float m;
+	memcpy(&m, &bits, sizeof(m));
+	// atanh series of the mantissa in [1, 2)
+	const float t = (m - 1) / (m + 1);
+	const float t2 = t * t;
+	return e + t * (2.8853901f + t2 * (0.9617967f + t2 * (0.5770780f + t2 * 0.4121986f)));
+}
+
+// fraction of the escape iteration from |z|^2 right after escaping the radius 2 circle, 0 at |z| = 4 and
+// 1 at |z| = 2. continuous across iterations for the quadratic map. left to the coloring, the logarithms
+// would cost the kernels as much as a low iteration frame.
+inline float escape_fraction(float r2)
+{
+	float f = 1 - fast_log2(0.5f * fast_log2(r2));
+	// written so that garbage in the r2 of pixels that did not escape comes out as 0
+	return f > 0 ? (f < 1 ? f : 1.0f) : 0.0f;
+}
+
+// stores the iteration count of a pixel. r2 is |z|^2 after the last iteration, only kept for pixels that
+// escaped and when the image has the buffer
+inline void plot(Image &image, int idx, int i, int n, double r2 = 4)
+{
+	image.iter[idx] = i;
+	if (image.r2)
+		image.r2[idx] = i < n ? float(r2) : 0;
+}
+
+// |z|^2 the distance estimate continues the orbit of an escaped pixel to. right at the radius 2 circle the
+// estimate is off by up to ten times for pixels escaping within a few iterations.
+constexpr double distance_radius2 = 1e6;
+
+// exterior distance estimate |z| ln|z| / |dz/dc| of the point c = (cu, cv) whose orbit escaped with z = (u, v)
+// and dz/dc = (du, dv), in pixels of spacing. the true distance lies between half and twice of it. the few
+// iterations to distance_radius2 run in double, z is far from the set and needs no more.
+inline float distance_estimate(double u, double v, double du, double dv, double cu, double cv, double spacing)
+{
+	double r2 = u * u + v * v;
+	for (int k = 0; k < 8 && r2 < distance_radius2; ++k) {
+		const double ndu = 2 * (u * du - v * dv) + 1;
+		dv = 2 * (u * dv + v * du);
+		du = ndu;
+		const double nu = u * u - v * v + cu;
+		v = 2 * u * v + cv;
+		u = nu;
+		r2 = u * u + v * v;
+	}
+	const double dr2 = du * du + dv * dv;
+	return dr2 > 0 ? float(sqrt(r2 / dr2) * 0.5 * log(r2) / spacing) : 0.0f;
+}
+
+// stores the distance estimate of a pixel along with plot(), 0 for pixels inside the set
+inline void plot_distance(Image &image, int idx, int i, int n, double u, double v, double du, double dv, double cu,
+                          double cv, double spacing)
+{
+	image.distance[idx] = i < n ? distance_estimate(u, v, du, dv, cu, cv, spacing) : 0.0f;
+}
+
+// pixels the continuous colorings compute gradient positions for in one go
+constexpr int shade_chunk = 256;
+
+// writes the gradient colors of count pixels, pos are their positions in gradient entries. pixels inside the
+// set or missing are black.
+inline void shade_gradient(const int *iter, const int *pos, uint32_t *dst, int count, int n, const Palette &palette)
+{
+	const int shift = palette.offset * int(gradient_size / palette_size);
+	for (int x = 0; x < count; ++x) {
+		const uint32_t c = palette.gradient[(pos[x] + shift) & (gradient_size - 1)];
+		dst[x] = iter[x] == n || iter[x] < 0 ? 0 : c;
+	}
+}
+
+// smooth coloring, the gradient at smooth_turns per doubling of the escape iteration plus its fraction.
+// stands in for the histogram coloring until the frame is done. the positions are computed without
+// branches, so the logarithms vectorize.
+inline void colorize_smooth(Image &image, int left, int top, int right, int bottom, int n, const Palette &palette)
+{
+	const float scale = palette.smooth_turns * gradient_size;
+	int pos[shade_chunk];
+	for (int y = top; y < bottom; ++y) {
+		const int *iter = image.iter + y * image.width;
+		const float *r2 = image.r2 ? image.r2 + y * image.width : nullptr;
+		uint32_t *row = reinterpret_cast<uint32_t *>(image.buf) + y * image.width;
+		for (int x0 = left; x0 < right; x0 += shade_chunk) {
+			const int count = std::min(shade_chunk, right - x0);
+			if (r2) {
+				for (int x = 0; x < count; ++x) {
+					const float mu = float(iter[x0 + x]) + escape_fraction(r2[x0 + x]);
+					pos[x] = int(fast_log2(mu + 1) * scale);
+				}
+			} else {
+				for (int x = 0; x < count; ++x)
+					pos[x] = int(fast_log2(float(iter[x0 + x]) + 1) * scale);
+			}
+			shade_gradient(iter + x0, pos, row + x0, count, n, palette);
+		}
+	}
+}
+
+// the boundary by the distance estimate, gray levels over the pixel closest to the set
+inline void colorize_distance(Image &image, int left, int top, int right, int bottom)
+{
+	for (int y = top; y < bottom; ++y) {
+		const int *iter = image.iter + y * image.width;
+		const float *distance = image.distance + y * image.width;
+		uint32_t *row = reinterpret_cast<uint32_t *>(image.buf) + y * image.width;
+		for (int x = left; x < right; ++x) {
+			const float d = iter[x] < 0 ? 0.0f : std::min(distance[x], 1.0f);
+			const uint32_t gray = uint32_t(d * 255);
+			row[x] = gray | gray << 8 | gray << 16;
+		}
+	}
+}
+
+// colors [left, right) x [top, bottom) from the iteration buffer. runs after every computed tile and over
+// the whole image when the palette changes, the kernels never touch the colors.
+inline void colorize(Image &image, int left, int top, int right, int bottom, int n, const Palette &palette)
+{
+	if (palette.coloring == Coloring::Distance && image.distance) {
+		colorize_distance(image, left, top, right, bottom);
+		return;
+	}
+	if (palette.coloring != Coloring::Bands) {
+		colorize_smooth(image, left, top, right, bottom, n, palette);
+		return;
+	}
+	static_assert((palette_size & (palette_size - 1)) == 0, "palette_size must be a power of two");
+	const uint32_t *table = &palette.color[0][0];
+	const int offset = palette.offset;
+	for (int y = top; y < bottom; ++y) {
+		const int *iter = image.iter + y * image.width;
+		uint32_t *row = reinterpret_cast<uint32_t *>(image.buf) + y * image.width;
+		int x = left;
+#if SIMD_LANES
+		x += shade_lanes(iter + left, row + left, right - left, n, table, offset, (int)palette_size);
+#endif
+		for (; x < right; ++x) {
+			const int i = iter[x];
+			const uint32_t c = table[(i & 3) * (int)palette_size + (((i >> 2) + offset) & (palette_size - 1))];
+			row[x] = i == n || i < 0 ? 0 : c;
+		}
+	}
+}
+
 template <typename T> Rect<T> collapse(const Rect<fp> &fractal)
 {
 	using namespace std;
@@ -58,9 +239,28 @@ template <typename T> Rect<T> collapse(const Rect<fp> &fractal)
 template <typename A, typename B> A e(B b) { return static_cast<A>(b); }
 
 #if LARGE_NUMBERS
-template <typename A> A e(const float128 &b) { return b.convert_to<A>(); }
+template <typename A> A e(const float128 &b)
+{
+	if constexpr (std::is_arithmetic_v<A>)
+		return b.convert_to<A>();
+	else
+		return A(b);
+}
+
+template <typename A, int N, int P> A e(const LargeNumber<N, P> &b)
+{
+	if constexpr (std::is_constructible_v<A, const LargeNumber<N, P> &>)
+		return A(b);
+	else
+		return b.template to<A>();
+}
+
+template <typename A> A e(const dd_real &b) { return b.to<A>(); }
+template <typename A> A e(const qd_real &b) { return b.to<A>(); }
 #endif
 
+template <typename T> T sqr(const T &a) { return a * a; }
+
 inline std::string fptostr(const fp &a)
 {
 	char buf[256];
@@ -80,11 +280,40 @@ inline std::string fptostr(const fp &a)
 		float128 x = std::get<2>(a);
 		return x.str();
 	}
+	case 3:
+		return std::get<3>(a).str();
+	case 4:
+		return std::get<4>(a).str();
+	case 5:
+		return std::get<5>(a).str();
+	case 6:
+		return std::get<6>(a).to<float128>().str();
+	case 7:
+		// float128 would cut it to 113 bits
+		return std::get<7>(a).to<fixed256>().str();
 #endif
 	}
 	assert(false);
 	return "";
 }
 
-template <typename T>
-int mandelbrot(Image &image, int left, int top, int width, int height, const Rect<T> &r, int n, const Palette &palette);
+// pixels a frame resolved as inside the set without running to max_iterations
+struct Shortcuts {
+	std::atomic<long long> cardioid{0};
+	std::atomic<long long> bulb{0};
+	std::atomic<long long> periodic{0};
+
+	void clear()
+	{
+		cardioid = 0;
+		bulb = 0;
+		periodic = 0;
+	}
+};
+
+// computes every xstep-th pixel of every ystep-th row of [left, width) x [top, height) with the formula F, see
+// formula.h. returns the iterations it ran, pixels the shortcuts caught take none. instantiated for every
+// precision and formula, with_formula() picks the instance of a runtime choice.
+template <typename T, typename F = mandelbrot_step>
+long long mandelbrot(Image &image, int left, int top, int width, int height, const Rect<T> &r, int n,
+                     Shortcuts *shortcuts = nullptr, int xstep = 1, int ystep = 1, const F &formula = F());
@@ -0,0 +1,263 @@
+#pragma once
+#include <math.h>
+#include <type_traits>
+
+// double-double (~106 bit) and quad-double (~212 bit) numbers built from error free transforms, after
+// Hida, Li and Bailey's qd library. V is double or a vector of doubles that provides + - * and fms(),
+// so the same code runs scalar and lane parallel. nothing here branches on values.
+
+inline double fms(double a, double b, double c) { return fma(a, b, -c); }
+
+// s + err == a + b exactly
+template <typename V> inline V two_sum(V a, V b, V &err)
+{
+	V s = a + b;
+	V bb = s - a;
+	err = (a - (s - bb)) + (b - bb);
+	return s;
+}
+
+// same as two_sum when |a| >= |b|
+template <typename V> inline V quick_two_sum(V a, V b, V &err)
+{
+	V s = a + b;
+	err = b - (s - a);
+	return s;
+}
+
+template <typename V> inline V two_prod(V a, V b, V &err)
+{
+	V p = a * b;
+	err = fms(a, b, p);
+	return p;
+}
+
+template <typename V> inline void three_sum(V &a, V &b, V &c)
+{
+	V t2, t3;
+	V t1 = two_sum(a, b, t2);
+	a = two_sum(c, t1, t3);
+	b = two_sum(t2, t3, c);
+}
+
+template <typename V> inline void three_sum2(V &a, V &b, V &c)
+{
+	V t2, t3;
+	V t1 = two_sum(a, b, t2);
+	a = two_sum(c, t1, t3);
+	b = t2 + t3;
+}
+
+// branch free version of the qd renormalization, lanes never diverge
+template <typename V> inline void renorm(V &c0, V &c1, V &c2, V &c3, V &c4)
+{
+	c3 = quick_two_sum(c3, c4, c4);
+	c2 = quick_two_sum(c2, c3, c3);
+	c1 = quick_two_sum(c1, c2, c2);
+	c0 = quick_two_sum(c0, c1, c1);
+
+	c0 = quick_two_sum(c0, c1, c1);
+	c1 = quick_two_sum(c1, c2, c2);
+	c2 = quick_two_sum(c2, c3, c3);
+	c3 = c3 + c4;
+}
+
+// width and mask of a vector type, specialized next to the vector types
+template <typename V> struct lane_info {
+};
+
+template <typename V> struct basic_dd : lane_info<V> {
+	V hi, lo;
+
+	basic_dd() : hi(), lo() {}
+	basic_dd(V h, V l = V()) : hi(h), lo(l) {}
+
+	// float128, fixed point or quad-double, peeled one double at a time
+	template <typename F, typename = std::enable_if_t<std::is_class_v<F> && std::is_same_v<V, double>>>
+	explicit basic_dd(const F &a)
+	{
+		hi = static_cast<double>(a);
+		lo = static_cast<double>(a - F(hi));
+	}
+
+	template <typename F> F to() const { return F(hi) + F(lo); }
+	explicit operator double() const { return hi; }
+	explicit operator float() const { return float(hi); }
+
+	static basic_dd set1(const basic_dd<double> &a) { return {V::set1(a.hi), V::set1(a.lo)}; }
+	static basic_dd iota(int a) { return {V::iota(a), V::set1(0)}; }
+
+	basic_dd operator-() const { return {V() - hi, V() - lo}; }
+
+	friend basic_dd operator+(const basic_dd &a, const basic_dd &b)
+	{
+		V s2, t2;
+		V s1 = two_sum(a.hi, b.hi, s2);
+		V t1 = two_sum(a.lo, b.lo, t2);
+		s2 = s2 + t1;
+		s1 = quick_two_sum(s1, s2, s2);
+		s2 = s2 + t2;
+		s1 = quick_two_sum(s1, s2, s2);
+		return {s1, s2};
+	}
+
+	friend basic_dd operator-(const basic_dd &a, const basic_dd &b) { return a + -b; }
+
+	friend basic_dd operator*(const basic_dd &a, const basic_dd &b)
+	{
+		V p2;
+		V p1 = two_prod(a.hi, b.hi, p2);
+		p2 = p2 + (a.hi * b.lo + a.lo * b.hi);
+		p1 = quick_two_sum(p1, p2, p2);
+		return {p1, p2};
+	}
+
+	friend basic_dd operator/(const basic_dd &a, const basic_dd &b)
+	{
+		V q1 = a.hi / b.hi;
+		basic_dd r = a - b * basic_dd(q1);
+		V q2 = r.hi / b.hi;
+		r = r - b * basic_dd(q2);
+		V q3 = r.hi / b.hi;
+		V e;
+		q1 = quick_two_sum(q1, q2, e);
+		return basic_dd(q1, e) + basic_dd(q3);
+	}
+
+	basic_dd &operator+=(const basic_dd &a) { return *this = *this + a; }
+	basic_dd &operator-=(const basic_dd &a) { return *this = *this - a; }
+	basic_dd &operator*=(const basic_dd &a) { return *this = *this * a; }
+	basic_dd &operator/=(const basic_dd &a) { return *this = *this / a; }
+
+	friend bool operator<(const basic_dd &a, const basic_dd &b)
+	{
+		return a.hi < b.hi || (a.hi == b.hi && a.lo < b.lo);
+	}
+	friend bool operator>(const basic_dd &a, const basic_dd &b) { return b < a; }
+	friend bool operator<=(const basic_dd &a, const basic_dd &b) { return !(b < a); }
+	friend bool operator>=(const basic_dd &a, const basic_dd &b) { return !(a < b); }
+	friend bool operator==(const basic_dd &a, const basic_dd &b) { return a.hi == b.hi && a.lo == b.lo; }
+	friend bool operator!=(const basic_dd &a, const basic_dd &b) { return !(a == b); }
+};
+
+template <typename V> basic_dd<V> sqr(const basic_dd<V> &a)
+{
+	V p2;
+	V p1 = two_prod(a.hi, a.hi, p2);
+	V t = a.hi * a.lo;
+	p2 = p2 + (t + t);
+	p1 = quick_two_sum(p1, p2, p2);
+	return {p1, p2};
+}
+
+template <typename V> struct basic_qd : lane_info<V> {
+	V x[4];
+
+	basic_qd() : x{} {}
+	basic_qd(V a, V b = V(), V c = V(), V d = V()) : x{a, b, c, d} {}
+
+	template <typename F, typename = std::enable_if_t<std::is_class_v<F> && std::is_same_v<V, double>>>
+	explicit basic_qd(const F &a)
+	{
+		F r = a;
+		for (int i = 0; i < 4; ++i) {
+			x[i] = static_cast<double>(r);
+			r = r - F(x[i]);
+		}
+	}
+
+	template <typename F> F to() const { return ((F(x[3]) + F(x[2])) + F(x[1])) + F(x[0]); }
+	explicit operator double() const { return x[0]; }
+	explicit operator float() const { return float(x[0]); }
+
+	static basic_qd set1(const basic_qd<double> &a)
+	{
+		return {V::set1(a.x[0]), V::set1(a.x[1]), V::set1(a.x[2]), V::set1(a.x[3])};
+	}
+	static basic_qd iota(int a) { return {V::iota(a), V::set1(0), V::set1(0), V::set1(0)}; }
+
+	basic_qd operator-() const { return {V() - x[0], V() - x[1], V() - x[2], V() - x[3]}; }
+
+	friend basic_qd operator+(const basic_qd &a, const basic_qd &b)
+	{
+		V t0, t1, t2, t3;
+		V s0 = two_sum(a.x[0], b.x[0], t0);
+		V s1 = two_sum(a.x[1], b.x[1], t1);
+		V s2 = two_sum(a.x[2], b.x[2], t2);
+		V s3 = two_sum(a.x[3], b.x[3], t3);
+		s1 = two_sum(s1, t0, t0);
+		three_sum(s2, t0, t1);
+		three_sum2(s3, t0, t2);
+		t0 = t0 + t1 + t3;
+		renorm(s0, s1, s2, s3, t0);
+		return {s0, s1, s2, s3};
+	}
+
+	friend basic_qd operator-(const basic_qd &a, const basic_qd &b) { return a + -b; }
+
+	friend basic_qd operator*(const basic_qd &a, const basic_qd &b)
+	{
+		V q0, q1, q2, q3, q4, q5;
+		V p0 = two_prod(a.x[0], b.x[0], q0);
+		V p1 = two_prod(a.x[0], b.x[1], q1);
+		V p2 = two_prod(a.x[1], b.x[0], q2);
+		V p3 = two_prod(a.x[0], b.x[2], q3);
+		V p4 = two_prod(a.x[1], b.x[1], q4);
+		V p5 = two_prod(a.x[2], b.x[0], q5);
+
+		three_sum(p1, p2, q0);
+
+		// (p2, q1, q2) + (p3, p4, p5)
+		three_sum(p2, q1, q2);
+		three_sum(p3, p4, p5);
+		V t0, t1;
+		V s0 = two_sum(p2, p3, t0);
+		V s1 = two_sum(q1, p4, t1);
+		V s2 = q2 + p5;
+		s1 = two_sum(s1, t0, t0);
+		s2 = s2 + (t0 + t1);
+
+		// eps^3 terms
+		s1 = s1 + (a.x[0] * b.x[3] + a.x[1] * b.x[2] + a.x[2] * b.x[1] + a.x[3] * b.x[0] + q0 + q3 + q4 + q5);
+		renorm(p0, p1, s0, s1, s2);
+		return {p0, p1, s0, s1};
+	}
+
+	friend basic_qd operator/(const basic_qd &a, const basic_qd &b)
+	{
+		V q[5];
+		basic_qd r = a;
+		for (int i = 0; i < 5; ++i) {
+			q[i] = r.x[0] / b.x[0];
+			r = r - b * basic_qd(q[i]);
+		}
+		renorm(q[0], q[1], q[2], q[3], q[4]);
+		return {q[0], q[1], q[2], q[3]};
+	}
+
+	basic_qd &operator+=(const basic_qd &a) { return *this = *this + a; }
+	basic_qd &operator-=(const basic_qd &a) { return *this = *this - a; }
+	basic_qd &operator*=(const basic_qd &a) { return *this = *this * a; }
+	basic_qd &operator/=(const basic_qd &a) { return *this = *this / a; }
+
+	friend bool operator<(const basic_qd &a, const basic_qd &b)
+	{
+		for (int i = 0; i < 4; ++i)
+			if (a.x[i] != b.x[i])
+				return a.x[i] < b.x[i];
+		return false;
+	}
+	friend bool operator>(const basic_qd &a, const basic_qd &b) { return b < a; }
+	friend bool operator<=(const basic_qd &a, const basic_qd &b) { return !(b < a); }
+	friend bool operator>=(const basic_qd &a, const basic_qd &b) { return !(a < b); }
+	friend bool operator==(const basic_qd &a, const basic_qd &b)
+	{
+		return a.x[0] == b.x[0] && a.x[1] == b.x[1] && a.x[2] == b.x[2] && a.x[3] == b.x[3];
+	}
+	friend bool operator!=(const basic_qd &a, const basic_qd &b) { return !(a == b); }
+};
+
+template <typename V> basic_qd<V> sqr(const basic_qd<V> &a) { return a * a; }
+
+using dd_real = basic_dd<double>;
+using qd_real = basic_qd<double>;
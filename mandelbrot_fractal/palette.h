@@ -65,18 +65,42 @@ inline uint32_t hsv2rgb(double h, double s, double v)
 	return pack(r, g, b);
 }
 
+enum class Coloring {
+	// the iterations cycle through the palette, four shades apart
+	Bands = 0,
+	// logarithm of the continuous escape iteration along the gradient
+	Smooth = 1,
+	// rank of the continuous escape iteration among the pixels of the frame along the gradient
+	Histogram = 2,
+	// gray by the distance estimate, black within a pixel of the set and white from a pixel away. thin boundary
+	// lines that stay connected where the filaments are finer than the pixels. smooth without a distance buffer
+	Distance = 3,
+};
+
 constexpr size_t palette_size = 1024;
+// one turn around the hue circle, the continuous colorings look colors up instead of converting them
+constexpr size_t gradient_size = 4096;
 struct Palette {
 	Palette()
 	{
-		for (int i = 0; i < palette_size; ++i) {
+		for (size_t i = 0; i < palette_size; ++i) {
 			double h = (240 + i * 8 * 360 / palette_size) % 360;
 			color[0][i] = hsv2rgb(h, 0.8, 0.8);
 			color[1][i] = hsv2rgb(h, 0.8, 0.6);
 			color[2][i] = hsv2rgb(h, 0.8, 0.4);
 			color[3][i] = hsv2rgb(h, 0.8, 0.6);
 		}
+		for (size_t i = 0; i < gradient_size; ++i)
+			gradient[i] = hsv2rgb(240 + i * 360.0 / gradient_size, 0.8, 0.8);
 	}
 
 	uint32_t color[4][palette_size];
+	uint32_t gradient[gradient_size];
+	// rotates the colors, cycling animates it
+	int offset = 0;
+	Coloring coloring = Coloring::Bands;
+	// turns of the gradient per doubling of the escape iteration
+	float smooth_turns = 0.5f;
+	// turns of the gradient from the first to the last escaping pixel, less than one keeps them apart
+	float histogram_turns = 0.75f;
 };
@@ -0,0 +1,95 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include "mandelbrot.h"
+#include "pool.h"
+
+// panning by whole pixels keeps every pixel that stays in the frame, only the strips moved in are new.
+// pixels still to be computed hold iteration -1.
+
+// moves the frame by (dx, dy) pixels into image, pixel (x, y) takes the value of (x + dx, y + dy) of from. from
+// may be image itself. the pixels that came from outside are marked missing. returns the number of missing
+// pixels, including the ones an unfinished frame left.
+inline long long shift(const Image &from, Image &image, int dx, int dy)
+{
+	const int w = image.width;
+	const int h = image.height;
+	const uint32_t *src = reinterpret_cast<const uint32_t *>(from.buf);
+	uint32_t *pixels = reinterpret_cast<uint32_t *>(image.buf);
+	const bool keep_r2 = image.r2 && from.r2;
+	const bool keep_distance = image.distance && from.distance;
+
+	// rows are walked away from the rows they read
+	for (int k = 0; k < h; ++k) {
+		const int y = dy > 0 ? k : h - 1 - k;
+		const int sy = y + dy;
+		int *iter = image.iter + y * w;
+		uint32_t *row = pixels + y * w;
+		if (sy < 0 || sy >= h) {
+			std::fill(iter, iter + w, -1);
+			std::fill(row, row + w, 0);
+			continue;
+		}
+
+		const int x0 = std::max(0, -dx);
+		const int x1 = std::min(w, w - dx);
+		if (x0 < x1) {
+			memmove(iter + x0, from.iter + sy * w + x0 + dx, (x1 - x0) * sizeof(int));
+			memmove(row + x0, src + sy * w + x0 + dx, (x1 - x0) * sizeof(uint32_t));
+			if (keep_r2)
+				memmove(image.r2 + y * w + x0, from.r2 + sy * w + x0 + dx, (x1 - x0) * sizeof(float));
+			if (keep_distance)
+				memmove(image.distance + y * w + x0, from.distance + sy * w + x0 + dx,
+				        (x1 - x0) * sizeof(float));
+		}
+		std::fill(iter, iter + std::min(x0, w), -1);
+		std::fill(row, row + std::min(x0, w), 0);
+		std::fill(iter + std::max(x1, 0), iter + w, -1);
+		std::fill(row + std::max(x1, 0), row + w, 0);
+	}
+
+	return std::count_if(image.iter, image.iter + w * h, [](int i) { return i < 0; });
+}
+
+// computes the missing pixels of the tile, render(left, top, right, bottom) as in mariani_silver.
+// consecutive rows missing completely go in one call. returns the number of pixels computed.
+template <typename F> int missing_tile(Image &image, const Tile &t, F &&render)
+{
+	const int stride = image.width;
+	auto whole = [&](int y) {
+		for (int x = t.x0; x < t.x1; ++x)
+			if (image.iter[x + y * stride] >= 0)
+				return false;
+		return true;
+	};
+
+	int written = 0;
+	int y = t.y0;
+	while (y < t.y1) {
+		if (whole(y)) {
+			int end = y + 1;
+			while (end < t.y1 && whole(end))
+				end++;
+			render(t.x0, y, t.x1, end);
+			written += (t.x1 - t.x0) * (end - y);
+			y = end;
+			continue;
+		}
+		int x = t.x0;
+		while (x < t.x1) {
+			if (image.iter[x + y * stride] >= 0) {
+				x++;
+				continue;
+			}
+			int end = x;
+			while (end < t.x1 && image.iter[end + y * stride] < 0)
+				end++;
+			render(x, y, end, y + 1);
+			written += end - x;
+			x = end;
+		}
+		y++;
+	}
+	return written;
+}
@@ -0,0 +1,366 @@
+#include <math.h>
+#include "debugging.h"
+#include "perturbation.h"
+
+// |z|^2 below this fraction of |Z|^2 means dz cancelled Z and the result lost its precision
+constexpr double glitch_tolerance = 1e-6;
+// series terms are dropped while |C| d^2 stays this small compared to |A|
+constexpr double series_tolerance = 1e-12;
+// glitched pixels of a tile get this many fresh references before they are iterated directly
+constexpr int max_references = 4;
+
+// iterate() of a pixel whose job was cancelled
+constexpr int abandoned = -2;
+
+static bool stop(const std::atomic<bool> *cancel, int i)
+{
+	return (i & (cancel_interval - 1)) == 0 && cancel && cancel->load(std::memory_order_relaxed);
+}
+
+template <typename T> Orbit reference_orbit(const T &cx, const T &cy, int n, const std::atomic<bool> *cancel)
+{
+	Orbit o;
+	o.x.reserve(n + 1);
+	o.y.reserve(n + 1);
+
+	T u = 0, v = 0;
+	for (int i = 0; i <= n; ++i) {
+		double du = e<double>(u), dv = e<double>(v);
+		o.x.push_back(du);
+		o.y.push_back(dv);
+		if (du * du + dv * dv >= 4 || stop(cancel, i + 1))
+			break;
+		T nextu = u * u - v * v + cx;
+		v = 2 * u * v + cy;
+		u = nextu;
+	}
+	return o;
+}
+
+template <typename T> static void prepare(Reference<T> &ref, const std::atomic<bool> *cancel)
+{
+	PROF;
+	const Rect<T> &r = ref.r;
+	ref.cx = (r.x0 + r.x1) / 2;
+	ref.cy = (r.y0 + r.y1) / 2;
+	ref.orbit = reference_orbit(ref.cx, ref.cy, ref.n, cancel);
+	ref.references++;
+
+	// largest |dc| in the frame, the corner farthest from the center
+	double dx = e<double>(r.x1 - r.x0) / 2;
+	double dy = e<double>(r.y1 - r.y0) / 2;
+	double d2 = dx * dx + dy * dy;
+
+	const Orbit &o = ref.orbit;
+	double a[2] = {0, 0}, b[2] = {0, 0}, c[2] = {0, 0};
+	int k = 0;
+	for (; k + 1 < (int)o.x.size() - 1; ++k) {
+		double zx = o.x[k], zy = o.y[k];
+		// A' = 2 Z A + 1, B' = 2 Z B + A^2, C' = 2 Z C + 2 A B
+		double na[2] = {2 * (zx * a[0] - zy * a[1]) + 1, 2 * (zx * a[1] + zy * a[0])};
+		double nb[2] = {2 * (zx * b[0] - zy * b[1]) + a[0] * a[0] - a[1] * a[1],
+		                2 * (zx * b[1] + zy * b[0]) + 2 * a[0] * a[1]};
+		double nc[2] = {2 * (zx * c[0] - zy * c[1]) + 2 * (a[0] * b[0] - a[1] * b[1]),
+		                2 * (zx * c[1] + zy * c[0]) + 2 * (a[0] * b[1] + a[1] * b[0])};
+
+		double abs_a = fabs(na[0]) + fabs(na[1]);
+		double abs_c = fabs(nc[0]) + fabs(nc[1]);
+		if (!(abs_c * d2 < series_tolerance * abs_a))
+			break;
+
+		a[0] = na[0], a[1] = na[1];
+		b[0] = nb[0], b[1] = nb[1];
+		c[0] = nc[0], c[1] = nc[1];
+	}
+
+	ref.skip = k;
+	ref.a[0] = a[0], ref.a[1] = a[1];
+	ref.b[0] = b[0], ref.b[1] = b[1];
+	ref.c[0] = c[0], ref.c[1] = c[1];
+}
+
+// dz/dc of a pixel for distance estimates, of the full z = Z + dz. dz/dc(n+1) = 2 z(n) dz/dc(n) + 1
+struct derivative {
+	double x = 0, y = 0;
+	// z at the escape
+	double zx = 0, zy = 0;
+};
+
+// iterates dz against the orbit starting at iteration i. returns the escape iteration, n for points
+// inside the set, -1 when the pixel glitched or abandoned once cancel is set. r2 is |z|^2 at the escape, the
+// iterations are added to ran. d, when given, holds dz/dc at iteration i and is iterated along.
+static int iterate(const Orbit &o, int i, int n, double dx, double dy, double dcx, double dcy, double &r2,
+                   const std::atomic<bool> *cancel, long long &ran, derivative *d = nullptr)
+{
+	const int len = (int)o.x.size();
+	const int first = i;
+	int result = n;
+	while (i < n) {
+		if (i >= len) {
+			result = -1;
+			break;
+		}
+		if (stop(cancel, i)) {
+			result = abandoned;
+			break;
+		}
+		double zx = o.x[i] + dx;
+		double zy = o.y[i] + dy;
+		double z2 = zx * zx + zy * zy;
+		r2 = z2;
+		if (z2 >= 4) {
+			if (d)
+				d->zx = zx, d->zy = zy;
+			result = i;
+			break;
+		}
+		double orbit2 = o.x[i] * o.x[i] + o.y[i] * o.y[i];
+		if (z2 < glitch_tolerance * orbit2) {
+			result = -1;
+			break;
+		}
+		if (d) {
+			double ndx = 2 * (zx * d->x - zy * d->y) + 1;
+			d->y = 2 * (zx * d->y + zy * d->x);
+			d->x = ndx;
+		}
+		double ndx = 2 * (o.x[i] * dx - o.y[i] * dy) + dx * dx - dy * dy + dcx;
+		dy = 2 * (o.x[i] * dy + o.y[i] * dx) + 2 * dx * dy + dcy;
+		dx = ndx;
+		i++;
+	}
+	ran += i - first;
+	return result;
+}
+
+template <typename T>
+static int direct(const T &u0, const T &v0, int n, double &r2, const std::atomic<bool> *cancel, long long &ran,
+                  derivative *d = nullptr)
+{
+	T u = 0, v = 0;
+	int i = 0;
+	while (u * u + v * v < 4 && i < n) {
+		if (d) {
+			// the derivative grows past what T holds for fixed point, double is plenty for it
+			const double zx = e<double>(u), zy = e<double>(v);
+			double ndx = 2 * (zx * d->x - zy * d->y) + 1;
+			d->y = 2 * (zx * d->y + zy * d->x);
+			d->x = ndx;
+		}
+		T nextu = u * u - v * v + u0;
+		v = 2 * u * v + v0;
+		u = nextu;
+		i++;
+		if (stop(cancel, i)) {
+			ran += i;
+			return abandoned;
+		}
+	}
+	ran += i;
+	r2 = e<double>(u * u + v * v);
+	if (d)
+		d->zx = e<double>(u), d->zy = e<double>(v);
+	return i;
+}
+
+// dz at the skipped iteration of the point dc away from the reference center, from the series
+template <typename T> static void series(const Reference<T> &ref, double dcx, double dcy, double &dx, double &dy)
+{
+	// dc^2 and dc^3
+	double c2x = dcx * dcx - dcy * dcy, c2y = 2 * dcx * dcy;
+	double c3x = c2x * dcx - c2y * dcy, c3y = c2x * dcy + c2y * dcx;
+	dx = ref.a[0] * dcx - ref.a[1] * dcy + ref.b[0] * c2x - ref.b[1] * c2y + ref.c[0] * c3x - ref.c[1] * c3y;
+	dy = ref.a[0] * dcy + ref.a[1] * dcx + ref.b[0] * c2y + ref.b[1] * c2x + ref.c[0] * c3y + ref.c[1] * c3x;
+}
+
+// dz/dc at the skipped iteration, the derivative of the series A + 2 B dc + 3 C dc^2
+template <typename T> static derivative series_derivative(const Reference<T> &ref, double dcx, double dcy)
+{
+	double c2x = dcx * dcx - dcy * dcy, c2y = 2 * dcx * dcy;
+	derivative d;
+	d.x = ref.a[0] + 2 * (ref.b[0] * dcx - ref.b[1] * dcy) + 3 * (ref.c[0] * c2x - ref.c[1] * c2y);
+	d.y = ref.a[1] + 2 * (ref.b[0] * dcy + ref.b[1] * dcx) + 3 * (ref.c[0] * c2y + ref.c[1] * c2x);
+	return d;
+}
+
+// iterate() of the point dc away from the reference center, from the skipped iteration on with dz from the
+// series. skip only bounds the error of the series, a point already outside the radius 2 circle there escaped
+// before it and is iterated from the start to find out when.
+template <typename T>
+static int iterate_series(const Reference<T> &ref, double dcx, double dcy, double &r2, const std::atomic<bool> *cancel,
+                          long long &ran, derivative *d)
+{
+	double dx, dy;
+	series(ref, dcx, dcy, dx, dy);
+	const double zx = ref.orbit.x[ref.skip] + dx, zy = ref.orbit.y[ref.skip] + dy;
+	if (!(zx * zx + zy * zy < 4)) {
+		if (d)
+			*d = derivative();
+		return iterate(ref.orbit, 0, ref.n, 0, 0, dcx, dcy, r2, cancel, ran, d);
+	}
+	if (d)
+		*d = series_derivative(ref, dcx, dcy);
+	return iterate(ref.orbit, ref.skip, ref.n, dx, dy, dcx, dcy, r2, cancel, ran, d);
+}
+
+template <typename T>
+long long perturbation(Image &image, int left, int top, int width, int height, Reference<T> &ref, int xstep,
+                       int ystep)
+{
+	const std::atomic<bool> *cancel = image.cancel;
+	std::call_once(ref.once, [&ref, cancel] { prepare(ref, cancel); });
+
+	const Rect<T> &r = ref.r;
+	const int n = ref.n;
+	const T scalex = (r.x1 - r.x0) / image.width;
+	const T scaley = (r.y1 - r.y0) / image.height;
+	const double sx = e<double>(scalex);
+	const double sy = e<double>(scaley);
+	// dc of pixel (0, 0), the rest of the frame is an exact multiple of the pixel spacing away
+	const double ox = e<double>(r.x0 - ref.cx);
+	const double oy = e<double>(r.y0 - ref.cy);
+
+	// the distance estimate iterates dz/dc next to dz when the image takes it
+	const bool estimate = image.distance != nullptr;
+	const double x0 = e<double>(r.x0), y0 = e<double>(r.y0);
+	auto put = [&image, n, sx, sy, x0, y0, estimate](int x, int y, int i, double r2, const derivative &d) {
+		plot(image, x + y * image.width, i, n, r2);
+		if (estimate)
+			plot_distance(image, x + y * image.width, i, n, d.zx, d.zy, d.x, d.y, x * sx + x0, y * sy + y0,
+			              sx);
+	};
+
+	long long ran = 0;
+	std::vector<std::pair<int, int>> glitched;
+	for (int y = top; y < height && !cancelled(image); y += ystep) {
+		for (int x = left; x < width; x += xstep) {
+			double dcx = x * sx + ox;
+			double dcy = y * sy + oy;
+			double r2;
+			derivative d;
+			int i = iterate_series(ref, dcx, dcy, r2, cancel, ran, estimate ? &d : nullptr);
+			if (i == abandoned)
+				return ran;
+			if (i < 0)
+				glitched.push_back({x, y});
+			else
+				put(x, y, i, r2, d);
+		}
+	}
+	ref.glitches += (int)glitched.size();
+
+	// re-reference on one of the glitched pixels and retry the rest against it, no series this time
+	for (int k = 0; k < max_references && !glitched.empty(); ++k) {
+		auto [rx, ry] = glitched[glitched.size() / 2];
+		Orbit o = reference_orbit(T(rx) * scalex + r.x0, T(ry) * scaley + r.y0, n, cancel);
+		ref.references++;
+
+		std::vector<std::pair<int, int>> left_over;
+		for (auto [x, y] : glitched) {
+			double dcx = (x - rx) * sx;
+			double dcy = (y - ry) * sy;
+			double r2;
+			derivative d;
+			int i = iterate(o, 0, n, 0, 0, dcx, dcy, r2, cancel, ran, estimate ? &d : nullptr);
+			if (i == abandoned)
+				return ran;
+			if (i < 0)
+				left_over.push_back({x, y});
+			else
+				put(x, y, i, r2, d);
+		}
+		glitched.swap(left_over);
+	}
+
+	for (auto [x, y] : glitched) {
+		double r2;
+		derivative d;
+		int i = direct(T(x) * scalex + r.x0, T(y) * scaley + r.y0, n, r2, cancel, ran, estimate ? &d : nullptr);
+		if (i == abandoned)
+			return ran;
+		put(x, y, i, r2, d);
+	}
+
+	return ran;
+}
+
+template <typename T>
+long long perturbation_points(Image &out, const double *px, const double *py, int count, int width, int height,
+                              Reference<T> &ref)
+{
+	std::call_once(ref.once, [&ref] { prepare(ref, nullptr); });
+
+	const Rect<T> &r = ref.r;
+	const int n = ref.n;
+	const T scalex = (r.x1 - r.x0) / width;
+	const T scaley = (r.y1 - r.y0) / height;
+	const double sx = e<double>(scalex);
+	const double sy = e<double>(scaley);
+	const double ox = e<double>(r.x0 - ref.cx);
+	const double oy = e<double>(r.y0 - ref.cy);
+	const bool estimate = out.distance != nullptr;
+	const double x0 = e<double>(r.x0), y0 = e<double>(r.y0);
+	auto put = [&out, n, px, py, sx, sy, x0, y0, estimate](int k, int i, double r2, const derivative &d) {
+		plot(out, k, i, n, r2);
+		if (estimate)
+			plot_distance(out, k, i, n, d.zx, d.zy, d.x, d.y, px[k] * sx + x0, py[k] * sy + y0, sx);
+	};
+
+	long long ran = 0;
+	std::vector<int> glitched;
+	for (int k = 0; k < count; ++k) {
+		double dcx = px[k] * sx + ox;
+		double dcy = py[k] * sy + oy;
+		double r2;
+		derivative d;
+		int i = iterate_series(ref, dcx, dcy, r2, nullptr, ran, estimate ? &d : nullptr);
+		if (i < 0)
+			glitched.push_back(k);
+		else
+			put(k, i, r2, d);
+	}
+
+	// the same fixes as for the pixels of perturbation()
+	for (int j = 0; j < max_references && !glitched.empty(); ++j) {
+		const int c = glitched[glitched.size() / 2];
+		Orbit o = reference_orbit(T(px[c]) * scalex + r.x0, T(py[c]) * scaley + r.y0, n);
+
+		std::vector<int> left_over;
+		for (int k : glitched) {
+			double dcx = (px[k] - px[c]) * sx;
+			double dcy = (py[k] - py[c]) * sy;
+			double r2;
+			derivative d;
+			int i = iterate(o, 0, n, 0, 0, dcx, dcy, r2, nullptr, ran, estimate ? &d : nullptr);
+			if (i < 0)
+				left_over.push_back(k);
+			else
+				put(k, i, r2, d);
+		}
+		glitched.swap(left_over);
+	}
+
+	for (int k : glitched) {
+		double r2;
+		derivative d;
+		int i = direct(T(px[k]) * scalex + r.x0, T(py[k]) * scaley + r.y0, n, r2, nullptr, ran,
+		               estimate ? &d : nullptr);
+		put(k, i, r2, d);
+	}
+	return ran;
+}
+
+#if LARGE_NUMBERS
+template Orbit reference_orbit<float128>(const float128 &cx, const float128 &cy, int n,
+                                         const std::atomic<bool> *cancel);
+template long long perturbation<float128>(Image &image, int left, int top, int width, int height,
+                                          Reference<float128> &ref, int xstep, int ystep);
+template long long perturbation_points<float128>(Image &out, const double *px, const double *py, int count, int width,
+                                                 int height, Reference<float128> &ref);
+template Orbit reference_orbit<fixed256>(const fixed256 &cx, const fixed256 &cy, int n,
+                                         const std::atomic<bool> *cancel);
+template long long perturbation<fixed256>(Image &image, int left, int top, int width, int height,
+                                          Reference<fixed256> &ref, int xstep, int ystep);
+template long long perturbation_points<fixed256>(Image &out, const double *px, const double *py, int count, int width,
+                                                 int height, Reference<fixed256> &ref);
+#endif
@@ -0,0 +1,61 @@
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+#include "mandelbrot.h"
+
+// deep zoom by perturbation: one reference orbit Z is iterated in T, every pixel only iterates its
+// difference dz = z - Z in double. dz(n+1) = 2 Z(n) dz(n) + dz(n)^2 + dc
+
+// Z(k) rounded to double, until the orbit escaped or reached n iterations
+struct Orbit {
+	std::vector<double> x;
+	std::vector<double> y;
+};
+
+// stops early once cancel is set
+template <typename T> Orbit reference_orbit(const T &cx, const T &cy, int n, const std::atomic<bool> *cancel = nullptr);
+
+// how far the series approximation got and what the glitches cost, of a reference in any type
+struct ReferenceStats {
+	int skip = 0;
+
+	// pixels that lost precision against a reference and the extra references it took to fix them
+	std::atomic<int> glitches{0};
+	std::atomic<int> references{0};
+};
+
+// float128 resolves views down to about 1e-33 of their coordinates, fixed256 goes on to about 1e-70
+template <typename T> struct Reference : ReferenceStats {
+	Reference(const Rect<T> &r, int n) : r(r), n(n) {}
+
+	Rect<T> r;
+	int n;
+
+	// filled by the first tile that needs it
+	std::once_flag once;
+	T cx, cy;
+	Orbit orbit;
+
+	// series approximation dz(skip) = A dc + B dc^2 + C dc^3
+	double a[2] = {0, 0};
+	double b[2] = {0, 0};
+	double c[2] = {0, 0};
+};
+
+#if LARGE_NUMBERS
+// the types perturbation() has reference orbits in
+template <typename T> constexpr bool has_reference = std::is_same_v<T, float128> || std::is_same_v<T, fixed256>;
+#endif
+
+// computes every xstep-th pixel of every ystep-th row and returns the iterations it ran, like mandelbrot()
+template <typename T>
+long long perturbation(Image &image, int left, int top, int width, int height, Reference<T> &ref, int xstep = 1,
+                       int ystep = 1);
+
+// computes points between the pixels of a width x height frame of ref, at pixel coordinates px[k], py[k],
+// into the pixels 0 to count of out. returns the iterations it ran.
+template <typename T>
+long long perturbation_points(Image &out, const double *px, const double *py, int count, int width, int height,
+                              Reference<T> &ref);
@@ -1,45 +1,279 @@
 #pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <functional>
+#include <memory>
+#include <mutex>
 #include <thread>
+#include <vector>
 
+// rectangle of pixels [x0, x1) x [y0, y1)
+struct Tile {
+	int x0;
+	int y0;
+	int x1;
+	int y1;
+	// how often the tile was split off a tile of make_tiles
+	int depth = 0;
+	// progressive pass the tile is queued for
+	int pass = 0;
+	// which image of a batch rendering several the tile belongs to
+	int frame = 0;
+};
+
+// splits the frame into size x size tiles. with center_out the tiles closest to the middle of the frame
+// come first, so the part the user is looking at is finished first.
+inline std::vector<Tile> make_tiles(int width, int height, int size, bool center_out)
+{
+	std::vector<Tile> tiles;
+	for (int y = 0; y < height; y += size)
+		for (int x = 0; x < width; x += size)
+			tiles.push_back({x, y, std::min(x + size, width), std::min(y + size, height)});
+
+	if (center_out) {
+		auto dist = [width, height](const Tile &t) {
+			long long dx = t.x0 + t.x1 - width;
+			long long dy = t.y0 + t.y1 - height;
+			return dx * dx + dy * dy;
+		};
+		std::stable_sort(tiles.begin(), tiles.end(),
+		                 [&dist](const Tile &a, const Tile &b) { return dist(a) < dist(b); });
+	}
+	return tiles;
+}
+
+// persistent worker threads, each with its own tile deque. a worker takes tiles from the front of its own
+// deque and, once that is empty, steals from the back of the others. several batches of tiles can be in
+// flight, a new one does not have to wait for the tiles still running of one that was dropped.
 class pool {
 	public:
-	pool() : cancel(true), finished(0) {}
+	// tiles submitted together
+	struct batch {
+		std::function<void(const Tile &)> job;
+		// called once every tile of the batch was done or dropped, by whoever did the last one
+		std::function<void()> finished;
+		std::atomic<int> pending{0};
+	};
+
+	pool() : stop(false), queued(0), pending(0) {}
+
+	~pool()
+	{
+		join();
+		{
+			std::lock_guard<std::mutex> lock(m);
+			stop = true;
+		}
+		wake.notify_all();
+		for (auto &w : workers)
+			w.join();
+	}
+
+	void start(int nthreads, const std::vector<Tile> &tiles, std::function<void(const Tile &)> f)
+	{
+		join();
+		submit(nthreads, tiles, std::move(f));
+	}
 
-	pool(std::function<void(int)> g) : cancel(true), finished(0) {}
+	// queues tiles next to the batches already there and returns at once. the pool only changes to nthreads
+	// threads once the tiles of the other batches are done.
+	std::shared_ptr<batch> submit(int nthreads, const std::vector<Tile> &tiles, std::function<void(const Tile &)> f,
+	                              std::function<void()> finished = nullptr)
+	{
+		spawn(nthreads);
 
-	~pool() { join(); }
+		auto b = std::make_shared<batch>();
+		b->job = std::move(f);
+		b->finished = std::move(finished);
+		b->pending = (int)tiles.size();
+		last = b;
+		if (tiles.empty()) {
+			if (b->finished)
+				b->finished();
+			return b;
+		}
 
-	void start(int nthreads, int iterations, std::function<void(int)> f)
+		pending += (int)tiles.size();
+		// round robin keeps the center-out order inside every deque
+		for (size_t i = 0; i < tiles.size(); ++i) {
+			queue &q = *queues[i % queues.size()];
+			std::lock_guard<std::mutex> lock(q.m);
+			q.tiles.push_back({tiles[i], b});
+		}
+		{
+			std::lock_guard<std::mutex> lock(m);
+			queued += (int)tiles.size();
+		}
+		wake.notify_all();
+		return b;
+	}
+
+	// queues more work for the batch of the running tile. called from a worker the tile goes to the front
+	// of its own deque, so it is worked on next while it is still in cache. with next false it goes to the
+	// back, behind everything queued before it.
+	void push(const Tile &tile, bool next = true)
 	{
-		cancel = false;
-		finished = 0;
-		for (int i = 0; i < nthreads; ++i) {
-			// printf("thread%d\n", i);
-			t.push_back(std::thread([i, iterations, f, this]() {
-				for (int j = 0; !cancel && j < iterations; ++j)
-					f(i * iterations + j);
-				finished++;
-			}));
+		bool own = worker_owner == this;
+		std::shared_ptr<batch> b = own ? worker_batch : last;
+		b->pending++;
+		pending++;
+		queue &q = *queues[own ? worker_index : 0];
+		{
+			std::lock_guard<std::mutex> lock(q.m);
+			if (own && next)
+				q.tiles.push_front({tile, b});
+			else
+				q.tiles.push_back({tile, b});
+		}
+		{
+			std::lock_guard<std::mutex> lock(m);
+			queued++;
 		}
+		wake.notify_one();
 	}
 
+	// drops the queued tiles of every batch and returns without waiting for the ones in flight
+	void drop()
+	{
+		for (auto &q : queues) {
+			std::deque<entry> dropped;
+			{
+				std::lock_guard<std::mutex> lock(q->m);
+				dropped.swap(q->tiles);
+				queued -= (int)dropped.size();
+			}
+			for (entry &e : dropped)
+				done_one(*e.b);
+		}
+	}
+
+	// drops the queued tiles and waits for the ones in flight
 	void join()
 	{
-		cancel = true;
-		for (int i = 0; i < t.size(); ++i)
-			if (t[i].joinable())
-				t[i].join();
+		drop();
+		wait();
+	}
 
-		t.clear();
-		finished = 0;
+	// waits for the queued tiles to be done, unlike join() it does not drop them
+	void wait()
+	{
+		std::unique_lock<std::mutex> lock(m);
+		done.wait(lock, [this] { return pending == 0; });
 	}
 
-	bool is_finished() const { return finished == t.size(); }
-	bool empty() const { return t.empty(); }
+	// waits until no tile of b is queued or running
+	void wait(const batch &b)
+	{
+		std::unique_lock<std::mutex> lock(m);
+		done.wait(lock, [&b] { return b.pending == 0; });
+	}
+
+	bool is_finished() const { return pending == 0; }
+	bool empty() const { return pending == 0; }
 
 	private:
-	bool cancel;
-	std::atomic<int> finished;
-	std::vector<std::thread> t;
+	struct entry {
+		Tile tile;
+		std::shared_ptr<batch> b;
+	};
+
+	struct queue {
+		std::mutex m;
+		std::deque<entry> tiles;
+	};
+
+	// restarts the workers with nthreads threads. the deques are rebuilt with them, so that only happens
+	// while no tile is queued or running, until then the pool keeps the threads it has.
+	void spawn(int nthreads)
+	{
+		if ((int)workers.size() == nthreads || (!workers.empty() && pending > 0))
+			return;
+		{
+			std::lock_guard<std::mutex> lock(m);
+			stop = true;
+		}
+		wake.notify_all();
+		for (auto &w : workers)
+			w.join();
+		workers.clear();
+		queues.clear();
+
+		stop = false;
+		for (int i = 0; i < nthreads; ++i)
+			queues.push_back(std::make_unique<queue>());
+		for (int i = 0; i < nthreads; ++i)
+			workers.push_back(std::thread([this, i] { run(i); }));
+	}
+
+	bool take(int i, entry &e)
+	{
+		for (size_t k = 0; k < queues.size(); ++k) {
+			queue &q = *queues[(i + k) % queues.size()];
+			std::lock_guard<std::mutex> lock(q.m);
+			if (q.tiles.empty())
+				continue;
+			if (k == 0) {
+				e = std::move(q.tiles.front());
+				q.tiles.pop_front();
+			} else {
+				e = std::move(q.tiles.back());
+				q.tiles.pop_back();
+			}
+			queued--;
+			return true;
+		}
+		return false;
+	}
+
+	void done_one(batch &b)
+	{
+		const bool last_of_batch = --b.pending == 0;
+		if (last_of_batch && b.finished)
+			b.finished();
+		if (--pending == 0 || last_of_batch) {
+			std::lock_guard<std::mutex> lock(m);
+			done.notify_all();
+		}
+	}
+
+	void run(int i)
+	{
+		worker_owner = this;
+		worker_index = i;
+		for (;;) {
+			{
+				std::unique_lock<std::mutex> lock(m);
+				wake.wait(lock, [this] { return stop || queued > 0; });
+				if (stop)
+					return;
+			}
+
+			entry e;
+			while (take(i, e)) {
+				worker_batch = e.b;
+				e.b->job(e.tile);
+				worker_batch.reset();
+				done_one(*e.b);
+				e.b.reset();
+			}
+		}
+	}
+
+	static inline thread_local const pool *worker_owner = nullptr;
+	static inline thread_local int worker_index = 0;
+	static inline thread_local std::shared_ptr<batch> worker_batch;
+
+	bool stop;
+	std::atomic<int> queued;
+	std::atomic<int> pending;
+	// batch of the tiles pushed from outside the workers
+	std::shared_ptr<batch> last;
+
+	std::mutex m;
+	std::condition_variable wake;
+	std::condition_variable done;
+	std::vector<std::unique_ptr<queue>> queues;
+	std::vector<std::thread> workers;
 };
@@ -0,0 +1,66 @@
+#pragma once
+#include <algorithm>
+#include "mandelbrot.h"
+#include "pool.h"
+
+// progressive rendering: pass p computes the pixels of a grid with spacing progressive_step(p) that no
+// earlier pass computed and stretches every grid sample over its step x step block, so each finished pass
+// is a complete picture at a lower resolution. the last pass has spacing 1 and leaves the exact pixels.
+
+// 1/16, 1/4, then all pixels
+constexpr int progressive_passes = 3;
+
+inline int progressive_step(int pass) { return 1 << (progressive_passes - 1 - pass); }
+
+// first multiple of step plus offset at or after x
+inline int progressive_align(int x, int step, int offset) { return (x - offset + step - 1) / step * step + offset; }
+
+inline int progressive_count(int lo, int hi, int step) { return lo < hi ? (hi - lo + step - 1) / step : 0; }
+
+// render(left, top, right, bottom, xstep, ystep) computes every xstep-th pixel of every ystep-th row of that
+// rectangle. runs pass t.pass of the tile, the earlier passes of the tile must be done. returns the number
+// of pixels computed.
+template <typename F> int progressive_pass(Image &image, const Tile &t, F &&render)
+{
+	const int s = progressive_step(t.pass);
+	const int first_x = progressive_align(t.x0, s, 0);
+	const int first_y = progressive_align(t.y0, s, 0);
+	int written = 0;
+
+	auto grid = [&](int x, int y, int xstep, int ystep) {
+		int count = progressive_count(x, t.x1, xstep) * progressive_count(y, t.y1, ystep);
+		if (count)
+			render(x, y, t.x1, t.y1, xstep, ystep);
+		written += count;
+	};
+
+	if (t.pass == 0) {
+		grid(first_x, first_y, s, s);
+	} else {
+		// rows between the coarser rows are new, the coarser rows only miss every other sample
+		grid(first_x, progressive_align(t.y0, 2 * s, s), s, 2 * s);
+		grid(progressive_align(t.x0, 2 * s, s), progressive_align(t.y0, 2 * s, 0), 2 * s, 2 * s);
+	}
+
+	if (s == 1)
+		return written;
+
+	const int stride = image.width;
+	for (int y = first_y; y < t.y1; y += s) {
+		for (int x = first_x; x < t.x1; x += s) {
+			const int i = image.iter[x + y * stride];
+			const float r2 = image.r2 ? image.r2[x + y * stride] : 0;
+			const float distance = image.distance ? image.distance[x + y * stride] : 0;
+			for (int by = y; by < std::min(y + s, t.y1); ++by) {
+				for (int bx = x; bx < std::min(x + s, t.x1); ++bx) {
+					image.iter[bx + by * stride] = i;
+					if (image.r2)
+						image.r2[bx + by * stride] = r2;
+					if (image.distance)
+						image.distance[bx + by * stride] = distance;
+				}
+			}
+		}
+	}
+	return written;
+}
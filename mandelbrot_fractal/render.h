@@ -0,0 +1,375 @@
+#pragma once
+#include <ctype.h>
+#include <math.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+#include "debugging.h"
+#include "mandelbrot.h"
+#include "perturbation.h"
+#include "pool.h"
+
+// rendering without a window: views given as exact decimal strings, computed on a pool and waited for
+
+enum class Precision
+{
+	Single = 0,
+	Double = 1,
+	Large = 2,
+	Fixed128 = 3,
+	Fixed192 = 4,
+	Fixed256 = 5,
+	DoubleDouble = 6,
+	QuadDouble = 7,
+	// pixels iterated in double against a reference orbit, in float128 or past its resolution in fixed256
+	Perturbation = 8,
+};
+
+// names of the precisions in job files, in the order of the enum
+constexpr const char *precision_names[] = {"single",   "double",        "large",       "fixed128",    "fixed192",
+                                           "fixed256", "double-double", "quad-double", "perturbation"};
+
+// false for an unknown name or one this build has no numbers for
+inline bool parse_precision(const std::string &s, Precision &p)
+{
+	constexpr int count = LARGE_NUMBERS ? 9 : 2;
+	for (int i = 0; i < count; ++i) {
+		if (s == precision_names[i]) {
+			p = static_cast<Precision>(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+// the precisions an automatic choice steps through, cheapest first as fractal_batch times them, and every one
+// finer than those before it. quad-double resolves more than fixed192 in less than half its time, fixed192 is
+// left out. large is slower than all of them and perturbation only pays off on deep views with many
+// iterations, both stay manual.
+constexpr Precision precision_ladder[] = {
+    Precision::Single,
+    Precision::Double,
+#if LARGE_NUMBERS
+    Precision::DoubleDouble,
+    Precision::Fixed128,
+    Precision::QuadDouble,
+    Precision::Fixed256,
+#endif
+};
+
+// the pixel spacing has to be this many times the rounding error of the coordinates, which the iterations
+// amplify
+constexpr double precision_margin = 256;
+
+// rounding error of p at coordinates up to magnitude. z stays within 2 of the origin while it iterates, so
+// the floating types never get finer than at 2, the fixed point ones have the same step everywhere.
+inline double precision_step(Precision p, double magnitude)
+{
+	const double m = std::max(magnitude, 2.0);
+	switch (p) {
+	case Precision::Single:
+		return ldexp(m, -24);
+	case Precision::Double:
+		return ldexp(m, -53);
+#if LARGE_NUMBERS
+	case Precision::Large:
+	case Precision::Perturbation:
+		return ldexp(m, -113);
+	case Precision::DoubleDouble:
+		return ldexp(m, -106);
+	case Precision::QuadDouble:
+		return ldexp(m, -212);
+	case Precision::Fixed128:
+		return ldexp(1.0, -fixed128::fraction_bits);
+	case Precision::Fixed192:
+		return ldexp(1.0, -fixed192::fraction_bits);
+	case Precision::Fixed256:
+		return ldexp(1.0, -fixed256::fraction_bits);
+#endif
+	}
+	return 0;
+}
+
+// the cheapest precision resolving pixels spacing apart at coordinates up to magnitude, the one of the ladder
+// with the smallest step when none does
+inline Precision choose_precision(double spacing, double magnitude)
+{
+	Precision finest = precision_ladder[0];
+	for (Precision p : precision_ladder) {
+		if (spacing >= precision_margin * precision_step(p, magnitude))
+			return p;
+		if (precision_step(p, magnitude) < precision_step(finest, magnitude))
+			finest = p;
+	}
+	return finest;
+}
+
+// pixel spacing and largest coordinate of r on width x height pixels. the spacing is taken in T, in double the
+// corners of a deep view are the same number.
+template <typename T> void measure(const Rect<T> &r, int width, int height, double &spacing, double &magnitude)
+{
+	spacing = std::min(fabs(e<double>(r.x1 - r.x0)) / width, fabs(e<double>(r.y1 - r.y0)) / height);
+	magnitude =
+	    std::max({fabs(e<double>(r.x0)), fabs(e<double>(r.x1)), fabs(e<double>(r.y0)), fabs(e<double>(r.y1))});
+}
+
+#if LARGE_NUMBERS
+// perturbation keeps the coordinates and the reference orbit in float128 while that resolves pixels spacing
+// apart at coordinates up to magnitude, past it in fixed256
+inline bool deep_perturbation(double spacing, double magnitude)
+{
+	return spacing < precision_margin * precision_step(Precision::Perturbation, magnitude);
+}
+#endif
+
+// rewrites a decimal "[-]int[.frac][e[-]exp]" as "[-]int[.frac]" by moving the point. false when s is
+// not a decimal or its integer part has more than 4 digits, the fixed point types would overflow.
+inline bool plain_decimal(const std::string &s, std::string &plain)
+{
+	size_t i = 0;
+	std::string sign;
+	if (i < s.size() && (s[i] == '-' || s[i] == '+'))
+		sign = s[i++] == '-' ? "-" : "";
+	std::string digits;
+	long point = -1;
+	for (; i < s.size() && (isdigit((unsigned char)s[i]) || s[i] == '.'); ++i) {
+		if (s[i] == '.') {
+			if (point >= 0)
+				return false;
+			point = (long)digits.size();
+		} else {
+			digits += s[i];
+		}
+	}
+	if (digits.empty())
+		return false;
+	if (point < 0)
+		point = (long)digits.size();
+	if (i < s.size() && (s[i] == 'e' || s[i] == 'E')) {
+		char *end;
+		long exp = strtol(s.c_str() + i + 1, &end, 10);
+		if (end == s.c_str() + i + 1 || exp < -100000 || exp > 100000)
+			return false;
+		point += exp;
+		i = end - s.c_str();
+	}
+	if (i != s.size())
+		return false;
+
+	if (point <= 0) {
+		digits.insert(0, -point + 1, '0');
+		point = 1;
+	} else if (point > (long)digits.size()) {
+		digits.append(point - digits.size(), '0');
+	}
+	size_t lead = 0;
+	while (lead + 1 < (size_t)point && digits[lead] == '0')
+		lead++;
+	if (point - lead > 4)
+		return false;
+	plain = sign + digits.substr(lead, point - lead);
+	if (point < (long)digits.size())
+		plain += "." + digits.substr(point);
+	return true;
+}
+
+// a plain decimal in T, rounded by the conversion of T
+template <typename T> T from_decimal(const std::string &plain)
+{
+	if constexpr (std::is_same_v<T, float>)
+		return strtof(plain.c_str(), nullptr);
+	else if constexpr (std::is_same_v<T, double>)
+		return strtod(plain.c_str(), nullptr);
+#if LARGE_NUMBERS
+	else if constexpr (std::is_same_v<T, float128>)
+		return float128(plain);
+	else if constexpr (std::is_same_v<T, dd_real> || std::is_same_v<T, qd_real>)
+		return T(fixed256::from_decimal(plain));
+	else
+		return T::from_decimal(plain);
+#endif
+}
+
+// a view by its center and the width of the real axis it shows, as decimals. the height follows from the
+// image.
+struct Location {
+	std::string x = "-0.75";
+	std::string y = "0";
+	std::string extent = "3";
+};
+
+// the corners of the view in T for an image of width x height pixels, false when a decimal does not parse
+template <typename T> bool location_rect(const Location &at, int width, int height, Rect<T> &r)
+{
+	std::string x, y, extent;
+	if (!plain_decimal(at.x, x) || !plain_decimal(at.y, y) || !plain_decimal(at.extent, extent))
+		return false;
+	const T cx = from_decimal<T>(x);
+	const T cy = from_decimal<T>(y);
+	const T w = from_decimal<T>(extent);
+	const T h = w * T(height) / T(width);
+	const T two = T(2);
+	r = {cx - w / two, cx + w / two, cy - h / two, cy + h / two};
+	return true;
+}
+
+#if LARGE_NUMBERS
+// deep_perturbation() of the deepest of count locations on images
+inline bool deep_locations(const Image *images, const Location *at, int count)
+{
+	for (int i = 0; i < count; ++i) {
+		Rect<fixed256> r;
+		double spacing, magnitude;
+		if (!location_rect(at[i], images[i].width, images[i].height, r))
+			continue;
+		measure(r, images[i].width, images[i].height, spacing, magnitude);
+		if (deep_perturbation(spacing, magnitude))
+			return true;
+	}
+	return false;
+}
+#endif
+
+// tiles of the headless renderers, 64x64 RGBA fit in L1
+constexpr int render_tile_size = 64;
+
+// traces a tile of frame while tracing is on: its wall time, the iterations the kernels report to it and, once
+// it is computed, how many of its pixels escaped or are inside the set
+class tile_span {
+	public:
+	tile_span(const Image &image, const Tile &t, long long frame, int n, const char *name = "tile")
+	    : image(image), t(t), n(n)
+	{
+		if (!trace::enabled())
+			return;
+		s.name = name;
+		s.frame = frame;
+		s.begin = monotonic_ns();
+	}
+
+	~tile_span()
+	{
+		if (!s.begin)
+			return;
+		s.end = monotonic_ns();
+		s.x0 = t.x0, s.y0 = t.y0, s.x1 = t.x1, s.y1 = t.y1;
+		for (int y = t.y0; y < t.y1 && counted; ++y) {
+			const int *iter = image.iter + y * image.width;
+			for (int x = t.x0; x < t.x1; ++x) {
+				s.interior += iter[x] == n;
+				s.escaped += iter[x] >= 0 && iter[x] < n;
+			}
+		}
+		trace::record(s);
+	}
+
+	void add(long long iterations) { s.iterations += iterations; }
+
+	// false while the pixels of the tile are not final yet, a later tile computes them
+	bool counted = true;
+
+	private:
+	const Image &image;
+	const Tile &t;
+	int n;
+	trace_span s;
+};
+
+// computes rects[i] into the iterations of images[i] for count images in one batch on workers and waits for
+// them. the tiles of all images are interleaved, threads done with one image help with the others instead of
+// idling at its end. perturbed only applies to the types with a reference orbit and the mandelbrot formula.
+template <typename T>
+void render_frames(Image *images, const Rect<T> *rects, int count, int n, bool perturbed, pool &workers,
+                   int nthreads, Shortcuts *shortcuts = nullptr, const FormulaParams &formula = FormulaParams())
+{
+	PROF;
+	std::vector<std::shared_ptr<Reference<T>>> refs(count);
+	std::vector<Tile> tiles;
+	for (int i = 0; i < count; ++i) {
+		if (perturbed && formula.formula == Formula::Mandelbrot)
+			refs[i] = std::make_shared<Reference<T>>(rects[i], n);
+		for (Tile t : make_tiles(images[i].width, images[i].height, render_tile_size, false)) {
+			t.frame = i;
+			tiles.push_back(t);
+		}
+	}
+	// every image's first tiles first, so all of them start before any ends
+	std::stable_sort(tiles.begin(), tiles.end(), [](const Tile &a, const Tile &b) {
+		return std::make_pair(a.y0, a.x0) < std::make_pair(b.y0, b.x0);
+	});
+	workers.start(nthreads, tiles, [images, rects, n, &refs, shortcuts, &formula](const Tile &t) {
+		Image &image = images[t.frame];
+		tile_span span(image, t, t.frame, n);
+#if LARGE_NUMBERS
+		if constexpr (has_reference<T>) {
+			if (refs[t.frame]) {
+				span.add(perturbation(image, t.x0, t.y0, t.x1, t.y1, *refs[t.frame]));
+				return;
+			}
+		}
+#endif
+		with_formula(formula, [&](const auto &step) {
+			span.add(mandelbrot(image, t.x0, t.y0, t.x1, t.y1, rects[t.frame], n, shortcuts, 1, 1, step));
+		});
+	});
+	workers.wait();
+}
+
+// computes r into the iterations of image on workers and waits for it
+template <typename T>
+void render(Image &image, const Rect<T> &r, int n, bool perturbed, pool &workers, int nthreads,
+            Shortcuts *shortcuts = nullptr, const FormulaParams &formula = FormulaParams())
+{
+	render_frames(&image, &r, 1, n, perturbed, workers, nthreads, shortcuts, formula);
+}
+
+// render_frames() of count locations at a precision, false when one of them does not parse
+inline bool render_locations(Image *images, const Location *at, int count, Precision precision, int n, pool &workers,
+                             int nthreads, Shortcuts *shortcuts = nullptr,
+                             const FormulaParams &formula = FormulaParams())
+{
+	auto run = [&](auto zero, bool perturbed = false) {
+		using T = decltype(zero);
+		std::vector<Rect<T>> rects(count);
+		for (int i = 0; i < count; ++i)
+			if (!location_rect(at[i], images[i].width, images[i].height, rects[i]))
+				return false;
+		render_frames(images, rects.data(), count, n, perturbed, workers, nthreads, shortcuts, formula);
+		return true;
+	};
+	switch (precision) {
+	case Precision::Single:
+		return run(float());
+	case Precision::Double:
+		return run(double());
+#if LARGE_NUMBERS
+	case Precision::Large:
+		return run(float128());
+	case Precision::Fixed128:
+		return run(fixed128());
+	case Precision::Fixed192:
+		return run(fixed192());
+	case Precision::Fixed256:
+		return run(fixed256());
+	case Precision::DoubleDouble:
+		return run(dd_real());
+	case Precision::QuadDouble:
+		return run(qd_real());
+	case Precision::Perturbation:
+		if (deep_locations(images, at, count))
+			return run(fixed256(), true);
+		return run(float128(), true);
+#endif
+	}
+	return false;
+}
+
+// render() of a location at a precision, false when it does not parse
+inline bool render_location(Image &image, const Location &at, Precision precision, int n, pool &workers, int nthreads,
+                        Shortcuts *shortcuts = nullptr, const FormulaParams &formula = FormulaParams())
+{
+	return render_locations(&image, &at, 1, precision, n, workers, nthreads, shortcuts, formula);
+}
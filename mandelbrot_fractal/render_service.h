@@ -0,0 +1,224 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "debugging.h"
+#include "mandelbrot.h"
+#include "pool.h"
+
+// the frames of the viewer as jobs on long-lived workers. submitting a job abandons the one before it without
+// waiting for it: its queued tiles are dropped and the kernels of its running tiles see the cancel flag of its
+// image within cancel_interval iterations. every job renders into buffers of its own, so a tile still running
+// for an abandoned job never writes into the frame on screen or into buffers that were freed.
+
+// iteration, r2, distance and color buffers of a frame of up to pixels pixels
+struct frame_buffers {
+	std::unique_ptr<uint8_t[]> buf;
+	std::unique_ptr<int[]> iter;
+	std::unique_ptr<float[]> r2;
+	std::unique_ptr<float[]> distance;
+	// the colors of the tiles published so far, see render_job::publish()
+	std::unique_ptr<uint8_t[]> shown;
+	size_t pixels = 0;
+
+	void allocate(size_t n)
+	{
+		buf.reset(new uint8_t[n * 4]);
+		iter.reset(new int[n]);
+		r2.reset(new float[n]);
+		distance.reset(new float[n]);
+		shown.reset(new uint8_t[n * 4]);
+		pixels = n;
+	}
+};
+
+struct render_job {
+	render_job(frame_buffers b, int width, int height) : buffers(std::move(b))
+	{
+		image.buf = buffers.buf.get();
+		image.buf_size = buffers.pixels * 4;
+		image.iter = buffers.iter.get();
+		image.r2 = buffers.r2.get();
+		image.width = width;
+		image.height = height;
+		image.cancel = &cancelled;
+		done = result.get_future().share();
+	}
+
+	// numbers the jobs of a service in the order they were submitted, the highest one is current
+	uint64_t generation = 0;
+	Image image;
+	std::atomic<bool> cancelled{false};
+	// max_iterations of the frame
+	int n = 0;
+	// every pixel holds its result or -1, so the frame can be shifted while it is unfinished
+	bool marked = false;
+	progress_info progress;
+	Shortcuts shortcuts;
+	// true once every tile was computed, false as soon as the job was abandoned
+	std::shared_future<bool> done;
+	// called by the worker finishing the last tile, never for an abandoned job
+	std::function<void(render_job &)> on_done;
+
+	// the kernels estimate the distance of every pixel to the set while on, it costs them the derivative
+	void track_distance(bool on) { image.distance = on ? buffers.distance.get() : nullptr; }
+
+	bool finished() const
+	{
+		return done.wait_for(std::chrono::seconds(0)) == std::future_status::ready && done.get();
+	}
+
+	// the colors of t are final for now and can go on screen. they are copied aside, so the screen never
+	// sees a tile while a later pass writes it again. an abandoned job publishes nothing.
+	void publish(const Tile &t)
+	{
+		if (cancelled)
+			return;
+		std::lock_guard<std::mutex> lock(publish_lock);
+		const size_t row = size_t(t.x1 - t.x0) * 4;
+		for (int y = t.y0; y < t.y1; ++y) {
+			const size_t at = (size_t(y) * image.width + t.x0) * 4;
+			memcpy(buffers.shown.get() + at, image.buf + at, row);
+		}
+		published.push_back(t);
+	}
+
+	// f(colors, tiles) gets the published colors of the whole image and the tiles published since the last
+	// call, if there are any. workers wait to publish while f runs.
+	template <typename F> void take_published(F &&f)
+	{
+		std::lock_guard<std::mutex> lock(publish_lock);
+		if (published.empty())
+			return;
+		f(static_cast<const uint8_t *>(buffers.shown.get()), static_cast<const std::vector<Tile> &>(published));
+		published.clear();
+	}
+
+	private:
+	friend class render_service;
+
+	// settles done once, the first call wins
+	void complete(bool computed)
+	{
+		if (settled.exchange(true))
+			return;
+		if (computed)
+			progress.execution_time_sec = clock.elapsed_time();
+		result.set_value(computed);
+		if (computed && on_done)
+			on_done(*this);
+	}
+
+	frame_buffers buffers;
+	std::promise<bool> result;
+	std::atomic<bool> settled{false};
+	Profiler clock;
+	std::mutex publish_lock;
+	std::vector<Tile> published;
+	// the tiles of the job, expired once none is queued or running
+	std::weak_ptr<pool::batch> tiles;
+};
+
+class render_service {
+	public:
+	~render_service()
+	{
+		cancel();
+		workers.join();
+		latest.reset();
+	}
+
+	// a job of width x height pixels, its buffers are taken over from a released job when one is large enough
+	std::shared_ptr<render_job> make_job(int width, int height)
+	{
+		const size_t pixels = size_t(width) * size_t(height);
+		frame_buffers b;
+		{
+			std::lock_guard<std::mutex> lock(spare_lock);
+			for (auto it = spares.begin(); it != spares.end(); ++it) {
+				if (it->pixels >= pixels) {
+					b = std::move(*it);
+					spares.erase(it);
+					break;
+				}
+			}
+		}
+		if (b.pixels < pixels)
+			b.allocate(pixels);
+		auto release = [this](render_job *job) {
+			recycle(std::move(job->buffers));
+			delete job;
+		};
+		return std::shared_ptr<render_job>(new render_job(std::move(b), width, height), release);
+	}
+
+	// abandons the current job and queues the tiles of job on nthreads workers, f computes one tile. returns at
+	// once, done of the job tells when it is finished.
+	void submit(const std::shared_ptr<render_job> &job, int nthreads, const std::vector<Tile> &tiles,
+	            std::function<void(render_job &, const Tile &)> f)
+	{
+		cancel();
+		job->generation = ++generation;
+		job->clock.start();
+		latest = job;
+		// tiles taken after the job was abandoned are skipped
+		auto b = workers.submit(
+		    nthreads, tiles,
+		    [job, f = std::move(f)](const Tile &t) {
+			    if (!job->cancelled)
+				    f(*job, t);
+		    },
+		    [job] { job->complete(!job->cancelled); });
+		job->tiles = b;
+	}
+
+	// queues one more tile for the job of the running tile, see pool::push()
+	void push(const Tile &tile, bool next = true) { workers.push(tile, next); }
+
+	// abandons the current job, done resolves to false at once. the tiles it has running stop on their own.
+	void cancel()
+	{
+		if (!latest)
+			return;
+		latest->cancelled = true;
+		latest->complete(false);
+		workers.drop();
+	}
+
+	// waits until no tile of an abandoned job runs anymore, which takes a few thousand iterations at most.
+	// only needed to read an unfinished image.
+	void settle(const std::shared_ptr<render_job> &job)
+	{
+		if (auto b = job->tiles.lock())
+			workers.wait(*b);
+	}
+
+	// the job was replaced by a newer one
+	bool superseded(const render_job &job) const { return job.generation != generation; }
+
+	private:
+	// released jobs keep their buffers for the next ones of the same size, panning makes a job per event
+	static constexpr int spare_frames = 2;
+
+	void recycle(frame_buffers b)
+	{
+		std::lock_guard<std::mutex> lock(spare_lock);
+		spares.push_back(std::move(b));
+		// the oldest go, after a resize they are the wrong size
+		if ((int)spares.size() > spare_frames)
+			spares.erase(spares.begin());
+	}
+
+	uint64_t generation = 0;
+	std::shared_ptr<render_job> latest;
+	std::mutex spare_lock;
+	std::vector<frame_buffers> spares;
+	// last, so the tiles in flight are done before the members they release their job to are gone
+	pool workers;
+};
@@ -0,0 +1,584 @@
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "debugging.h"
+#include "mandelbrot.h"
+#include "pool.h"
+#include "palette.h"
+#include "coloring.h"
+#include "iterations.h"
+#include "render.h"
+#include "image_file.h"
+#include "tile_pyramid.h"
+
+using namespace std;
+
+// serves the tile pyramid of tile_pyramid.h as /{z}/{x}/{y}.png for slippy map viewers, with y counting down
+// from the top like the map tiles of the web. a tile is taken from the PNGs served before, else colored from the
+// iterations in the tile cache, else rendered: its 64x64 parts go to one pool shared by all requests, the
+// precision is the cheapest that resolves the level and the iterations grow with it. requests for a tile
+// already being rendered wait for that render instead of starting their own. / is a viewer page, /stats the
+// counters as JSON.
+
+struct Options {
+	int port = 8080;
+	int nthreads = (int)thread::hardware_concurrency();
+	// renders waiting or running, more are turned away with 503
+	int max_pending = 256;
+	int max_connections = 256;
+	// 0 for depth_iterations() of the level
+	int iterations = 0;
+	FormulaParams formula;
+	Coloring coloring = Coloring::Smooth;
+	string tiles_path;
+	int megabytes = 256;
+};
+
+// log2 buckets of the latencies in microseconds, four per octave
+class latency_histogram {
+	public:
+	static constexpr int buckets = 4 * 40;
+
+	void add(double seconds)
+	{
+		const double us = std::max(1.0, seconds * 1e6);
+		const int b = std::min(buckets - 1, int(4 * log2(us)));
+		counts[b]++;
+		total_us += (long long)us;
+		count++;
+		long long m = max_us.load();
+		while ((long long)us > m && !max_us.compare_exchange_weak(m, (long long)us)) {
+		}
+	}
+
+	// upper end of the bucket of the q-th quantile in milliseconds, at most the largest latency
+	double quantile_ms(double q) const
+	{
+		const long long n = count.load();
+		long long seen = 0;
+		for (int b = 0; b < buckets; ++b) {
+			seen += counts[b].load();
+			if (n > 0 && seen >= q * n)
+				return std::min(exp2((b + 1) / 4.0) * 1e-3, max_ms());
+		}
+		return 0;
+	}
+
+	double mean_ms() const { return count ? total_us.load() * 1e-3 / count.load() : 0; }
+	double max_ms() const { return max_us.load() * 1e-3; }
+
+	private:
+	atomic<long long> counts[buckets] = {};
+	atomic<long long> total_us{0};
+	atomic<long long> count{0};
+	atomic<long long> max_us{0};
+};
+
+// events per second over the last seconds, one counter per second
+class rate_meter {
+	public:
+	static constexpr int seconds = 10;
+
+	void add()
+	{
+		lock_guard<mutex> hold(lock);
+		advance();
+		slots[now % seconds]++;
+	}
+
+	// over the last full seconds
+	double rate()
+	{
+		lock_guard<mutex> hold(lock);
+		advance();
+		long long sum = 0;
+		for (int s = 1; s < seconds; ++s)
+			sum += slots[(now - s + seconds) % seconds];
+		return double(sum) / (seconds - 1);
+	}
+
+	private:
+	void advance()
+	{
+		const long long t = (long long)Profiler::get();
+		for (long long s = now + 1; s <= t && s <= now + seconds; ++s)
+			slots[s % seconds] = 0;
+		now = std::max(now, t);
+	}
+
+	mutex lock;
+	long long now = 0;
+	long long slots[seconds] = {};
+};
+
+struct server_stats {
+	atomic<long long> requests{0};
+	// tiles by where they came from
+	atomic<long long> png_hits{0};
+	atomic<long long> tile_hits{0};
+	atomic<long long> rendered{0};
+	// requests that waited for the render of another one
+	atomic<long long> coalesced{0};
+	atomic<long long> rejected{0};
+	atomic<long long> not_found{0};
+	// tiles that could not be rendered or encoded
+	atomic<long long> failed{0};
+	atomic<long long> iterations{0};
+	latency_histogram latency;
+	latency_histogram render_time;
+	rate_meter tiles_per_second;
+	double begin = Profiler::get();
+};
+
+// the PNG of a tile, shared by every request for it
+using png_future = shared_future<shared_ptr<const vector<uint8_t>>>;
+
+class tile_server {
+	public:
+	explicit tile_server(const Options &o)
+	    : o(o), tiles(o.tiles_path, size_t(o.megabytes) << 20), pngs("", size_t(o.megabytes) << 20)
+	{
+		palette.coloring = o.coloring;
+	}
+
+	// false for a tile outside the pyramid
+	bool key(int z, long long x, long long y, TileKey &k) const
+	{
+		if (z < 0 || z > pyramid_max_level || x < 0 || y < 0 || x >= 1ll << z || y >= 1ll << z)
+			return false;
+		const double spacing = ldexp(1.0, -(z + 6));
+		k.formula = o.formula;
+		// pixels near the corners of the square are the largest coordinates
+		k.precision = choose_precision(spacing, 2);
+		k.n = o.iterations ? o.iterations : depth_iterations(ldexp(4.0, -z));
+		k.level = z;
+		k.x = x;
+		k.y = (1ll << z) - 1 - y;
+		return true;
+	}
+
+	// the PNG of the tile of k into png and the HTTP status: 200, 503 when it is turned away and 500 when it
+	// can't be made
+	int tile(const TileKey &k, shared_ptr<const vector<uint8_t>> &png)
+	{
+		png_future wait;
+		shared_ptr<promise<shared_ptr<const vector<uint8_t>>>> result;
+		const string path = k.path();
+		{
+			// finish() stores the PNG before it leaves in_flight, under this lock a tile is found in one
+			// of them until it was evicted
+			lock_guard<mutex> hold(lock);
+			vector<uint8_t> data;
+			if (pngs.get(k, data)) {
+				stats.png_hits++;
+				png = make_shared<const vector<uint8_t>>(std::move(data));
+				return 200;
+			}
+			auto it = in_flight.find(path);
+			if (it != in_flight.end()) {
+				wait = it->second;
+			} else {
+				if ((int)in_flight.size() >= o.max_pending) {
+					stats.rejected++;
+					return 503;
+				}
+				result = make_shared<promise<shared_ptr<const vector<uint8_t>>>>();
+				wait = result->get_future().share();
+				in_flight[path] = wait;
+			}
+		}
+		if (!result) {
+			stats.coalesced++;
+		} else {
+			auto job = make_shared<tile_job>(k, result);
+			vector<uint8_t> data;
+			const bool cached = tiles.get(k, data) && decode_tile(data, job->iter.data(), job->r2.data(),
+			                                                      tile_pixels, tile_pixels, k.n);
+			if (cached) {
+				stats.tile_hits++;
+				finish(*job, false);
+			} else if (!render(job)) {
+				fail(*job);
+			}
+		}
+		png = wait.get();
+		return png && !png->empty() ? 200 : 500;
+	}
+
+	server_stats stats;
+
+	private:
+	struct tile_job {
+		tile_job(const TileKey &k, shared_ptr<promise<shared_ptr<const vector<uint8_t>>>> result)
+		    : key(k), result(std::move(result)), buf(size_t(tile_pixels) * tile_pixels * 4),
+		      iter(size_t(tile_pixels) * tile_pixels), r2(size_t(tile_pixels) * tile_pixels)
+		{
+			image.buf = buf.data();
+			image.buf_size = buf.size();
+			image.iter = iter.data();
+			image.r2 = r2.data();
+			image.width = tile_pixels;
+			image.height = tile_pixels;
+		}
+
+		TileKey key;
+		shared_ptr<promise<shared_ptr<const vector<uint8_t>>>> result;
+		vector<uint8_t> buf;
+		vector<int> iter;
+		vector<float> r2;
+		Image image;
+		atomic<long long> iterations{0};
+		double begin = Profiler::get();
+	};
+
+	// queues the parts of the tile on the pool, the worker doing the last one finishes the tile. false when
+	// the location of the tile does not parse at its precision.
+	bool render(const shared_ptr<tile_job> &job)
+	{
+		switch (job->key.precision) {
+		case Precision::Single:
+			return render<float>(job);
+		case Precision::Double:
+			return render<double>(job);
+#if LARGE_NUMBERS
+		case Precision::Large:
+		case Precision::Perturbation:
+			return render<float128>(job);
+		case Precision::Fixed128:
+			return render<fixed128>(job);
+		case Precision::Fixed192:
+			return render<fixed192>(job);
+		case Precision::Fixed256:
+			return render<fixed256>(job);
+		case Precision::DoubleDouble:
+			return render<dd_real>(job);
+		case Precision::QuadDouble:
+			return render<qd_real>(job);
+#endif
+		}
+		return false;
+	}
+
+	template <typename T> bool render(const shared_ptr<tile_job> &job)
+	{
+		const TileKey &k = job->key;
+		Rect<T> r;
+		const Location at = pyramid_location({k.level, k.x * tile_pixels, k.y * tile_pixels}, tile_pixels,
+		                                     tile_pixels);
+		if (!location_rect(at, tile_pixels, tile_pixels, r))
+			return false;
+		auto part = [job, r](const Tile &t) {
+			tile_job &j = *job;
+			with_formula(j.key.formula, [&](const auto &step) {
+				j.iterations += mandelbrot(j.image, t.x0, t.y0, t.x1, t.y1, r, j.key.n, nullptr, 1, 1,
+				                           step);
+			});
+		};
+		// the pool takes batches from one thread at a time
+		lock_guard<mutex> hold(submit_lock);
+		workers.submit(o.nthreads, make_tiles(tile_pixels, tile_pixels, render_tile_size, false), part,
+		               [this, job] { finish(*job, true); });
+		return true;
+	}
+
+	// colors the tile, keeps it and hands it to the requests waiting for it
+	void finish(tile_job &job, bool rendered)
+	{
+		if (rendered) {
+			const int n = job.key.n;
+			tiles.put(job.key, encode_tile(job.iter.data(), job.r2.data(), tile_pixels, tile_pixels, n));
+			stats.rendered++;
+			stats.iterations += job.iterations;
+			stats.render_time.add(Profiler::get() - job.begin);
+		}
+		colorize(job.image, 0, 0, tile_pixels, tile_pixels, job.key.n, palette);
+		auto png = make_shared<const vector<uint8_t>>(encode_png(job.image));
+		if (png->empty()) {
+			fail(job);
+			return;
+		}
+		pngs.put(job.key, *png);
+		{
+			lock_guard<mutex> hold(lock);
+			in_flight.erase(job.key.path());
+		}
+		job.result->set_value(png);
+	}
+
+	// answers the requests waiting for the tile with 500, the next request tries again
+	void fail(tile_job &job)
+	{
+		stats.failed++;
+		{
+			lock_guard<mutex> hold(lock);
+			in_flight.erase(job.key.path());
+		}
+		job.result->set_value(nullptr);
+	}
+
+	const Options o;
+	Palette palette;
+	// iterations of the tiles, in memory and in o.tiles_path
+	tile_cache tiles;
+	// the PNGs served, in memory only
+	tile_cache pngs;
+	mutex lock;
+	map<string, png_future> in_flight;
+	mutex submit_lock;
+	// last, the tiles in flight are done before the members they use go
+	pool workers;
+};
+
+static const char *viewer_page = R"(<!doctype html>
+<html><head><meta charset="utf-8"><title>fractal</title>
+<link rel="stylesheet" href="https://unpkg.com/leaflet@1.9.4/dist/leaflet.css">
+<script src="https://unpkg.com/leaflet@1.9.4/dist/leaflet.js"></script>
+<style>html, body, #map { height: 100%; margin: 0; background: #000; }</style></head>
+<body><div id="map"></div><script>
+var square = [[-256, 0], [0, 256]];
+var map = L.map('map', {crs: L.CRS.Simple, minZoom: 0, maxZoom: 40});
+L.tileLayer('/{z}/{x}/{y}.png', {tileSize: 256, noWrap: true, bounds: square, maxZoom: 40}).addTo(map);
+map.fitBounds(square);
+</script></body></html>
+)";
+
+// "name": {"mean": ..., "p50": ..., ...} of the latencies of h
+static string quantiles_json(const char *name, const latency_histogram &h)
+{
+	char json[256];
+	snprintf(json, sizeof(json),
+	         "\"%s\": {\"mean\": %.3f, \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f}", name,
+	         h.mean_ms(), h.quantile_ms(0.5), h.quantile_ms(0.9), h.quantile_ms(0.99), h.max_ms());
+	return json;
+}
+
+static string stats_json(tile_server &server)
+{
+	server_stats &s = server.stats;
+	const double uptime = std::max(Profiler::get() - s.begin, 1e-3);
+	const long long served = s.png_hits + s.tile_hits + s.rendered + s.coalesced;
+	char json[1024];
+	snprintf(json, sizeof(json),
+	         "{\"uptime_s\": %.1f, \"requests\": %lld, \"png_hits\": %lld, \"tile_hits\": %lld, "
+	         "\"rendered\": %lld, \"coalesced\": %lld, \"rejected\": %lld, \"not_found\": %lld, \"failed\": %lld,\n"
+	         " \"tiles_per_s\": %.1f, \"tiles_per_s_recent\": %.1f, \"miter_per_s\": %.1f,\n",
+	         uptime, s.requests.load(), s.png_hits.load(), s.tile_hits.load(), s.rendered.load(),
+	         s.coalesced.load(), s.rejected.load(), s.not_found.load(), s.failed.load(), served / uptime,
+	         s.tiles_per_second.rate(), s.iterations * 1e-6 / uptime);
+	return json + (" " + quantiles_json("latency_ms", s.latency)) + ",\n " +
+	       quantiles_json("render_ms", s.render_time) + "}\n";
+}
+
+static bool send_all(int fd, const void *data, size_t size)
+{
+	const char *p = static_cast<const char *>(data);
+	while (size > 0) {
+		const ssize_t sent = send(fd, p, size, 0);
+		if (sent <= 0)
+			return false;
+		p += sent;
+		size -= sent;
+	}
+	return true;
+}
+
+static bool respond(int fd, int status, const char *type, const void *body, size_t size, bool keep_alive)
+{
+	const char *reason = status == 200   ? "OK"
+	                     : status == 400 ? "Bad Request"
+	                     : status == 404 ? "Not Found"
+	                     : status == 405 ? "Method Not Allowed"
+	                     : status == 500 ? "Internal Server Error"
+	                                     : "Service Unavailable";
+	char head[512];
+	const int n = snprintf(head, sizeof(head),
+	                       "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n"
+	                       "Access-Control-Allow-Origin: *\r\n%s%s\r\n",
+	                       status, reason, type, size, status == 503 ? "Retry-After: 1\r\n" : "",
+	                       keep_alive ? "Connection: keep-alive\r\n" : "Connection: close\r\n");
+	return send_all(fd, head, n) && send_all(fd, body, size);
+}
+
+static bool respond_text(int fd, int status, const string &text, bool keep_alive)
+{
+	return respond(fd, status, "text/plain", text.data(), text.size(), keep_alive);
+}
+
+// answers the requests of one connection until the client closes it or asks to
+static void serve(int fd, tile_server &server)
+{
+	string in;
+	char chunk[4096];
+	for (;;) {
+		size_t end;
+		while ((end = in.find("\r\n\r\n")) == string::npos) {
+			if (in.size() > 16384)
+				return (void)respond_text(fd, 400, "request too large\n", false);
+			const ssize_t got = recv(fd, chunk, sizeof(chunk), 0);
+			if (got <= 0)
+				return;
+			in.append(chunk, got);
+		}
+		const double begin = Profiler::get();
+		const string request = in.substr(0, end);
+		in.erase(0, end + 4);
+
+		char method[16], target[1024], version[16];
+		if (sscanf(request.c_str(), "%15s %1023s %15s", method, target, version) != 3)
+			return (void)respond_text(fd, 400, "bad request\n", false);
+		string lower = request;
+		for (char &c : lower)
+			c = (char)tolower((unsigned char)c);
+		const bool keep_alive = strcmp(version, "HTTP/1.0") && lower.find("connection: close") == string::npos;
+
+		server_stats &s = server.stats;
+		s.requests++;
+		bool ok;
+		int z;
+		long long x, y;
+		char tail;
+		TileKey k;
+		if (strcmp(method, "GET")) {
+			ok = respond_text(fd, 405, "only GET\n", keep_alive);
+		} else if (!strcmp(target, "/")) {
+			ok = respond(fd, 200, "text/html", viewer_page, strlen(viewer_page), keep_alive);
+		} else if (!strcmp(target, "/stats")) {
+			const string json = stats_json(server);
+			ok = respond(fd, 200, "application/json", json.data(), json.size(), keep_alive);
+		} else if (sscanf(target, "/%d/%lld/%lld.pn%c", &z, &x, &y, &tail) == 4 && tail == 'g' &&
+		           server.key(z, x, y, k)) {
+			shared_ptr<const vector<uint8_t>> png;
+			const int status = server.tile(k, png);
+			if (status == 200) {
+				ok = respond(fd, 200, "image/png", png->data(), png->size(), keep_alive);
+				s.latency.add(Profiler::get() - begin);
+				s.tiles_per_second.add();
+			} else if (status == 503) {
+				ok = respond_text(fd, 503, "busy\n", keep_alive);
+			} else {
+				ok = respond_text(fd, 500, "can't render the tile\n", keep_alive);
+			}
+		} else {
+			s.not_found++;
+			ok = respond_text(fd, 404, "not found\n", keep_alive);
+		}
+		if (!ok || !keep_alive)
+			return;
+	}
+}
+
+static bool parse_int(const char *s, int lo, int hi, int &v)
+{
+	char *end;
+	long a = strtol(s, &end, 10);
+	if (!*s || *end || a < lo || a > hi)
+		return false;
+	v = (int)a;
+	return true;
+}
+
+static void usage()
+{
+	fprintf(stderr,
+	        "usage: fractal_server [options]\n"
+	        "serves the tiles of the fractal as /{z}/{x}/{y}.png on localhost, / is a viewer, /stats the counters\n"
+	        "  -p port        8080\n"
+	        "  -t threads     render threads\n"
+	        "  -n iterations  fixed limit instead of one growing with the level\n"
+	        "  -F formula     mandelbrot, julia[:cx,cy], burning-ship or multibrot[:degree], mandelbrot\n"
+	        "  -c coloring    bands or smooth, smooth\n"
+	        "  -C tiles       directory keeping the iterations of the tiles across runs\n"
+	        "  -M megabytes   tiles and PNGs kept in memory, 256 each\n"
+	        "  -q renders     renders waiting or running before requests are turned away, 256\n");
+}
+
+int main(int argc, char **argv)
+{
+	Options o;
+	for (int i = 1; i < argc; ++i) {
+		const char *a = argv[i];
+		const char *v = i + 1 < argc ? argv[i + 1] : "";
+		bool ok = true;
+		if (!strcmp(a, "-p")) {
+			ok = parse_int(v, 1, 65535, o.port);
+		} else if (!strcmp(a, "-t")) {
+			ok = parse_int(v, 1, 1024, o.nthreads);
+		} else if (!strcmp(a, "-n")) {
+			ok = parse_int(v, 1, 1 << 30, o.iterations);
+		} else if (!strcmp(a, "-F")) {
+			ok = parse_formula(v, o.formula);
+		} else if (!strcmp(a, "-c")) {
+			ok = !strcmp(v, "bands") || !strcmp(v, "smooth");
+			o.coloring = strcmp(v, "bands") ? Coloring::Smooth : Coloring::Bands;
+		} else if (!strcmp(a, "-C")) {
+			o.tiles_path = v;
+		} else if (!strcmp(a, "-M")) {
+			ok = parse_int(v, 0, 1 << 20, o.megabytes);
+		} else if (!strcmp(a, "-q")) {
+			ok = parse_int(v, 1, 1 << 20, o.max_pending);
+		} else {
+			ok = false;
+		}
+		if (!ok) {
+			usage();
+			return 2;
+		}
+		i++;
+	}
+
+	const int listener = socket(AF_INET, SOCK_STREAM, 0);
+	const int on = 1;
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((uint16_t)o.port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (listener < 0 || ::bind(listener, (sockaddr *)&addr, sizeof(addr)) || listen(listener, 128)) {
+		fprintf(stderr, "can't listen on port %d: %s\n", o.port, strerror(errno));
+		return 1;
+	}
+	// a client closing early must not end the server
+	signal(SIGPIPE, SIG_IGN);
+	fprintf(stderr, "serving http://localhost:%d/ with %d render threads\n", o.port, o.nthreads);
+
+	tile_server server(o);
+	atomic<int> connections{0};
+	for (;;) {
+		const int fd = accept(listener, nullptr, nullptr);
+		if (fd < 0)
+			continue;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+		// idle connections close after a while
+		timeval timeout = {30, 0};
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		if (connections >= o.max_connections) {
+			respond_text(fd, 503, "too many connections\n", false);
+			close(fd);
+			continue;
+		}
+		connections++;
+		thread([fd, &server, &connections] {
+			serve(fd, server);
+			close(fd);
+			connections--;
+		}).detach();
+	}
+}
@@ -0,0 +1,259 @@
+#pragma once
+#include <stdint.h>
+#include "multi_double.h"
+
+// thin wrappers over the widest vector unit the compiler was told about (-march=native or /arch:AVX2).
+// every lane type provides the same small set of operations so the kernels can be written once.
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#define SIMD_LANES 1
+#include <immintrin.h>
+#else
+#define SIMD_LANES 0
+#endif
+
+#if SIMD_LANES
+
+#if defined(__AVX512F__)
+
+struct f32xN {
+	using scalar = float;
+	using mask = __mmask16;
+	static constexpr int width = 16;
+
+	__m512 v;
+
+	static f32xN set1(float a) { return {_mm512_set1_ps(a)}; }
+	static f32xN iota(int a)
+	{
+		return {_mm512_add_ps(_mm512_set1_ps(float(a)),
+		                      _mm512_setr_ps(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15))};
+	}
+};
+
+inline f32xN operator+(f32xN a, f32xN b) { return {_mm512_add_ps(a.v, b.v)}; }
+inline f32xN operator-(f32xN a, f32xN b) { return {_mm512_sub_ps(a.v, b.v)}; }
+inline f32xN operator*(f32xN a, f32xN b) { return {_mm512_mul_ps(a.v, b.v)}; }
+inline __mmask16 lt(f32xN a, f32xN b) { return _mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ); }
+inline f32xN inc(f32xN c, __mmask16 m) { return {_mm512_mask_add_ps(c.v, m, c.v, _mm512_set1_ps(1))}; }
+inline void store(int *dst, f32xN a) { _mm512_storeu_si512(dst, _mm512_cvttps_epi32(a.v)); }
+inline void store(float *dst, f32xN a) { _mm512_storeu_ps(dst, a.v); }
+inline void store(double *dst, f32xN a)
+{
+	_mm512_storeu_pd(dst, _mm512_cvtps_pd(_mm512_castps512_ps256(a.v)));
+	_mm512_storeu_pd(dst + 8, _mm512_cvtps_pd(_mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(a.v), 1))));
+}
+inline f32xN select(__mmask16 m, f32xN a, f32xN b) { return {_mm512_mask_blend_ps(m, b.v, a.v)}; }
+inline f32xN absolute(f32xN a) { return {_mm512_abs_ps(a.v)}; }
+
+struct f64xN {
+	using scalar = double;
+	using mask = __mmask8;
+	static constexpr int width = 8;
+
+	__m512d v;
+
+	static f64xN set1(double a) { return {_mm512_set1_pd(a)}; }
+	static f64xN iota(int a)
+	{
+		return {_mm512_add_pd(_mm512_set1_pd(double(a)), _mm512_setr_pd(0, 1, 2, 3, 4, 5, 6, 7))};
+	}
+};
+
+inline f64xN operator+(f64xN a, f64xN b) { return {_mm512_add_pd(a.v, b.v)}; }
+inline f64xN operator-(f64xN a, f64xN b) { return {_mm512_sub_pd(a.v, b.v)}; }
+inline f64xN operator*(f64xN a, f64xN b) { return {_mm512_mul_pd(a.v, b.v)}; }
+inline __mmask8 lt(f64xN a, f64xN b) { return _mm512_cmp_pd_mask(a.v, b.v, _CMP_LT_OQ); }
+inline f64xN inc(f64xN c, __mmask8 m) { return {_mm512_mask_add_pd(c.v, m, c.v, _mm512_set1_pd(1))}; }
+inline void store(int *dst, f64xN a) { _mm256_storeu_si256((__m256i *)dst, _mm512_cvttpd_epi32(a.v)); }
+inline void store(float *dst, f64xN a) { _mm256_storeu_ps(dst, _mm512_cvtpd_ps(a.v)); }
+inline void store(double *dst, f64xN a) { _mm512_storeu_pd(dst, a.v); }
+inline f64xN select(__mmask8 m, f64xN a, f64xN b) { return {_mm512_mask_blend_pd(m, b.v, a.v)}; }
+inline f64xN absolute(f64xN a) { return {_mm512_abs_pd(a.v)}; }
+inline f64xN fma(f64xN a, f64xN b, f64xN c) { return {_mm512_fmadd_pd(a.v, b.v, c.v)}; }
+inline f64xN fms(f64xN a, f64xN b, f64xN c) { return {_mm512_fmsub_pd(a.v, b.v, c.v)}; }
+
+inline bool any(__mmask16 m) { return m != 0; }
+inline bool any(__mmask8 m) { return m != 0; }
+inline __mmask16 both(__mmask16 a, __mmask16 b) { return a & b; }
+inline __mmask8 both(__mmask8 a, __mmask8 b) { return a & b; }
+inline __mmask16 either(__mmask16 a, __mmask16 b) { return a | b; }
+inline __mmask8 either(__mmask8 a, __mmask8 b) { return a | b; }
+inline __mmask16 but(__mmask16 a, __mmask16 b) { return a & ~b; }
+inline __mmask8 but(__mmask8 a, __mmask8 b) { return a & ~b; }
+inline int bits(__mmask16 m) { return m; }
+inline int bits(__mmask8 m) { return m; }
+
+// one gather per 16 pixels: table[(i & 3) * size + ((i >> 2) + offset & size - 1)], 0 where i is n or
+// negative. size is a power of two. returns how many pixels it did, the caller does the rest.
+inline int shade_lanes(const int *iter, uint32_t *dst, int count, int n, const uint32_t *table, int offset, int size)
+{
+	const __m512i vn = _mm512_set1_epi32(n);
+	const __m512i voffset = _mm512_set1_epi32(offset);
+	const __m512i vsize = _mm512_set1_epi32(size);
+	const __m512i wrap = _mm512_set1_epi32(size - 1);
+	const __m512i three = _mm512_set1_epi32(3);
+	int x = 0;
+	for (; x + 16 <= count; x += 16) {
+		__m512i i = _mm512_loadu_si512(iter + x);
+		__m512i row = _mm512_mullo_epi32(_mm512_and_si512(i, three), vsize);
+		__m512i col = _mm512_and_si512(_mm512_add_epi32(_mm512_srai_epi32(i, 2), voffset), wrap);
+		__m512i c = _mm512_i32gather_epi32(_mm512_add_epi32(row, col), table, 4);
+		__mmask16 lit = _mm512_cmpneq_epi32_mask(i, vn) & _mm512_cmpge_epi32_mask(i, _mm512_setzero_si512());
+		_mm512_storeu_si512(dst + x, _mm512_maskz_mov_epi32(lit, c));
+	}
+	return x;
+}
+
+#else
+
+struct f32xN {
+	using scalar = float;
+	using mask = __m256;
+	static constexpr int width = 8;
+
+	__m256 v;
+
+	static f32xN set1(float a) { return {_mm256_set1_ps(a)}; }
+	static f32xN iota(int a)
+	{
+		return {_mm256_add_ps(_mm256_set1_ps(float(a)), _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7))};
+	}
+};
+
+inline f32xN operator+(f32xN a, f32xN b) { return {_mm256_add_ps(a.v, b.v)}; }
+inline f32xN operator-(f32xN a, f32xN b) { return {_mm256_sub_ps(a.v, b.v)}; }
+inline f32xN operator*(f32xN a, f32xN b) { return {_mm256_mul_ps(a.v, b.v)}; }
+inline __m256 lt(f32xN a, f32xN b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+inline f32xN inc(f32xN c, __m256 m) { return {_mm256_add_ps(c.v, _mm256_and_ps(m, _mm256_set1_ps(1)))}; }
+inline void store(int *dst, f32xN a) { _mm256_storeu_si256((__m256i *)dst, _mm256_cvttps_epi32(a.v)); }
+inline void store(float *dst, f32xN a) { _mm256_storeu_ps(dst, a.v); }
+inline void store(double *dst, f32xN a)
+{
+	_mm256_storeu_pd(dst, _mm256_cvtps_pd(_mm256_castps256_ps128(a.v)));
+	_mm256_storeu_pd(dst + 4, _mm256_cvtps_pd(_mm256_extractf128_ps(a.v, 1)));
+}
+inline f32xN select(__m256 m, f32xN a, f32xN b) { return {_mm256_blendv_ps(b.v, a.v, m)}; }
+inline f32xN absolute(f32xN a) { return {_mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v)}; }
+inline bool any(__m256 m) { return _mm256_movemask_ps(m) != 0; }
+
+struct f64xN {
+	using scalar = double;
+	using mask = __m256d;
+	static constexpr int width = 4;
+
+	__m256d v;
+
+	static f64xN set1(double a) { return {_mm256_set1_pd(a)}; }
+	static f64xN iota(int a) { return {_mm256_add_pd(_mm256_set1_pd(double(a)), _mm256_setr_pd(0, 1, 2, 3))}; }
+};
+
+inline f64xN operator+(f64xN a, f64xN b) { return {_mm256_add_pd(a.v, b.v)}; }
+inline f64xN operator-(f64xN a, f64xN b) { return {_mm256_sub_pd(a.v, b.v)}; }
+inline f64xN operator*(f64xN a, f64xN b) { return {_mm256_mul_pd(a.v, b.v)}; }
+inline __m256d lt(f64xN a, f64xN b) { return _mm256_cmp_pd(a.v, b.v, _CMP_LT_OQ); }
+inline f64xN inc(f64xN c, __m256d m) { return {_mm256_add_pd(c.v, _mm256_and_pd(m, _mm256_set1_pd(1)))}; }
+inline void store(int *dst, f64xN a) { _mm_storeu_si128((__m128i *)dst, _mm256_cvttpd_epi32(a.v)); }
+inline void store(float *dst, f64xN a) { _mm_storeu_ps(dst, _mm256_cvtpd_ps(a.v)); }
+inline void store(double *dst, f64xN a) { _mm256_storeu_pd(dst, a.v); }
+inline f64xN select(__m256d m, f64xN a, f64xN b) { return {_mm256_blendv_pd(b.v, a.v, m)}; }
+inline f64xN absolute(f64xN a) { return {_mm256_andnot_pd(_mm256_set1_pd(-0.0), a.v)}; }
+#if defined(__FMA__)
+inline f64xN fma(f64xN a, f64xN b, f64xN c) { return {_mm256_fmadd_pd(a.v, b.v, c.v)}; }
+inline f64xN fms(f64xN a, f64xN b, f64xN c) { return {_mm256_fmsub_pd(a.v, b.v, c.v)}; }
+#endif
+inline bool any(__m256d m) { return _mm256_movemask_pd(m) != 0; }
+
+inline __m256 both(__m256 a, __m256 b) { return _mm256_and_ps(a, b); }
+inline __m256d both(__m256d a, __m256d b) { return _mm256_and_pd(a, b); }
+inline __m256 either(__m256 a, __m256 b) { return _mm256_or_ps(a, b); }
+inline __m256d either(__m256d a, __m256d b) { return _mm256_or_pd(a, b); }
+inline __m256 but(__m256 a, __m256 b) { return _mm256_andnot_ps(b, a); }
+inline __m256d but(__m256d a, __m256d b) { return _mm256_andnot_pd(b, a); }
+inline int bits(__m256 m) { return _mm256_movemask_ps(m); }
+inline int bits(__m256d m) { return _mm256_movemask_pd(m); }
+
+// one gather per 8 pixels: table[(i & 3) * size + ((i >> 2) + offset & size - 1)], 0 where i is n or
+// negative. size is a power of two. returns how many pixels it did, the caller does the rest.
+inline int shade_lanes(const int *iter, uint32_t *dst, int count, int n, const uint32_t *table, int offset, int size)
+{
+	const __m256i vn = _mm256_set1_epi32(n);
+	const __m256i voffset = _mm256_set1_epi32(offset);
+	const __m256i vsize = _mm256_set1_epi32(size);
+	const __m256i wrap = _mm256_set1_epi32(size - 1);
+	const __m256i three = _mm256_set1_epi32(3);
+	int x = 0;
+	for (; x + 8 <= count; x += 8) {
+		__m256i i = _mm256_loadu_si256((const __m256i *)(iter + x));
+		__m256i row = _mm256_mullo_epi32(_mm256_and_si256(i, three), vsize);
+		__m256i col = _mm256_and_si256(_mm256_add_epi32(_mm256_srai_epi32(i, 2), voffset), wrap);
+		__m256i c = _mm256_i32gather_epi32((const int *)table, _mm256_add_epi32(row, col), 4);
+		__m256i dark = _mm256_or_si256(_mm256_cmpeq_epi32(i, vn), _mm256_cmpgt_epi32(_mm256_setzero_si256(), i));
+		_mm256_storeu_si256((__m256i *)(dst + x), _mm256_andnot_si256(dark, c));
+	}
+	return x;
+}
+
+#endif
+
+#if defined(__AVX512F__) || defined(__FMA__)
+#define SIMD_MULTI_DOUBLE 1
+
+// double-double and quad-double lanes, escape tests and counters only look at the leading double
+template <> struct lane_info<f64xN> {
+	static constexpr int width = f64xN::width;
+	using mask = f64xN::mask;
+};
+
+inline f64xN::mask lt(const basic_dd<f64xN> &a, const basic_dd<f64xN> &b) { return lt(a.hi, b.hi); }
+inline basic_dd<f64xN> inc(const basic_dd<f64xN> &c, f64xN::mask m) { return {inc(c.hi, m), c.lo}; }
+inline void store(int *dst, const basic_dd<f64xN> &a) { store(dst, a.hi); }
+inline void store(float *dst, const basic_dd<f64xN> &a) { store(dst, a.hi); }
+inline void store(double *dst, const basic_dd<f64xN> &a) { store(dst, a.hi); }
+inline basic_dd<f64xN> select(f64xN::mask m, const basic_dd<f64xN> &a, const basic_dd<f64xN> &b)
+{
+	return {select(m, a.hi, b.hi), select(m, a.lo, b.lo)};
+}
+inline basic_dd<f64xN> absolute(const basic_dd<f64xN> &a) { return select(lt(a.hi, f64xN::set1(0)), -a, a); }
+
+inline f64xN::mask lt(const basic_qd<f64xN> &a, const basic_qd<f64xN> &b) { return lt(a.x[0], b.x[0]); }
+inline basic_qd<f64xN> inc(const basic_qd<f64xN> &c, f64xN::mask m)
+{
+	return {inc(c.x[0], m), c.x[1], c.x[2], c.x[3]};
+}
+inline void store(int *dst, const basic_qd<f64xN> &a) { store(dst, a.x[0]); }
+inline void store(float *dst, const basic_qd<f64xN> &a) { store(dst, a.x[0]); }
+inline void store(double *dst, const basic_qd<f64xN> &a) { store(dst, a.x[0]); }
+inline basic_qd<f64xN> select(f64xN::mask m, const basic_qd<f64xN> &a, const basic_qd<f64xN> &b)
+{
+	return {select(m, a.x[0], b.x[0]), select(m, a.x[1], b.x[1]), select(m, a.x[2], b.x[2]),
+	        select(m, a.x[3], b.x[3])};
+}
+inline basic_qd<f64xN> absolute(const basic_qd<f64xN> &a)
+{
+	return select(lt(a.x[0], f64xN::set1(0)), -a, a);
+}
+#else
+#define SIMD_MULTI_DOUBLE 0
+#endif
+
+// lane type used for a given scalar precision, void when there is none
+template <typename T> struct lanes {
+	using type = void;
+};
+template <> struct lanes<float> {
+	using type = f32xN;
+};
+template <> struct lanes<double> {
+	using type = f64xN;
+};
+#if SIMD_MULTI_DOUBLE
+template <> struct lanes<dd_real> {
+	using type = basic_dd<f64xN>;
+};
+template <> struct lanes<qd_real> {
+	using type = basic_qd<f64xN>;
+};
+#endif
+
+#endif
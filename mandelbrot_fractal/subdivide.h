@@ -0,0 +1,122 @@
+#pragma once
+#include <math.h>
+#include <vector>
+#include "mandelbrot.h"
+#include "pool.h"
+
+// Mariani-Silver: a tile whose border has one iteration count everywhere is filled without iterating the
+// inside, any other tile is cut in four along a computed cross and every quarter becomes a new tile.
+// with distance estimates a tile is also done once a border pixel proves the whole tile far outside the set.
+
+// tiles at most this wide or high are computed pixel by pixel
+constexpr int subdivide_min_size = 8;
+// a tile counts as far outside when it stays this many pixels from the set, the distance coloring shows
+// everything beyond one pixel the same
+constexpr float far_outside = 2;
+
+// the pixel of the tile's border that proves it far outside, -1 when none does. the set keeps at least a
+// half of a pixel's estimate away from it (Koebe), minus the tile diagonal for the pixel's farthest
+// neighbor in the tile. margin gets that bound.
+inline int far_border_pixel(const Image &image, const Tile &t, float &margin)
+{
+	const float diagonal = hypotf(float(t.x1 - t.x0), float(t.y1 - t.y0));
+	const int stride = image.width;
+	int best = -1;
+	float most = 0;
+	auto look = [&image, &best, &most](int i) {
+		if (image.distance[i] > most) {
+			most = image.distance[i];
+			best = i;
+		}
+	};
+	for (int x = t.x0; x < t.x1; ++x) {
+		look(x + t.y0 * stride);
+		look(x + (t.y1 - 1) * stride);
+	}
+	for (int y = t.y0 + 1; y < t.y1 - 1; ++y) {
+		look(t.x0 + y * stride);
+		look(t.x1 - 1 + y * stride);
+	}
+	margin = most / 2 - diagonal;
+	return margin >= far_outside ? best : -1;
+}
+
+// render(left, top, right, bottom) computes that rectangle into image. tiles of depth 0 compute their own
+// border first, split tiles arrive with theirs done. returns the number of pixels written.
+template <typename F> int mariani_silver(Image &image, const Tile &t, F &&render, std::vector<Tile> &split)
+{
+	int written = 0;
+	if (t.depth == 0) {
+		render(t.x0, t.y0, t.x1, t.y0 + 1);
+		render(t.x0, t.y1 - 1, t.x1, t.y1);
+		render(t.x0, t.y0 + 1, t.x0 + 1, t.y1 - 1);
+		render(t.x1 - 1, t.y0 + 1, t.x1, t.y1 - 1);
+		written += (t.x1 - t.x0) * (t.y1 - t.y0) - std::max(0, t.x1 - t.x0 - 2) * std::max(0, t.y1 - t.y0 - 2);
+	}
+
+	const int w = t.x1 - t.x0;
+	const int h = t.y1 - t.y0;
+	if (w <= 2 || h <= 2)
+		return written;
+
+	// the rest of a far tile only matters as white to the distance coloring, it takes the iterations of the
+	// border pixel that proved it and the lower bound of the distance
+	float margin;
+	const int far = image.distance ? far_border_pixel(image, t, margin) : -1;
+	if (far >= 0) {
+		const int stride = image.width;
+		for (int y = t.y0 + 1; y < t.y1 - 1; ++y) {
+			for (int x = t.x0 + 1; x < t.x1 - 1; ++x) {
+				image.iter[x + y * stride] = image.iter[far];
+				if (image.r2)
+					image.r2[x + y * stride] = image.r2[far];
+				image.distance[x + y * stride] = margin;
+			}
+		}
+		return written + (w - 2) * (h - 2);
+	}
+
+	if (w <= subdivide_min_size || h <= subdivide_min_size) {
+		render(t.x0 + 1, t.y0 + 1, t.x1 - 1, t.y1 - 1);
+		return written + (w - 2) * (h - 2);
+	}
+
+	const int *iter = image.iter;
+	const int stride = image.width;
+	const int first = iter[t.x0 + t.y0 * stride];
+	bool uniform = true;
+	for (int x = t.x0; x < t.x1 && uniform; ++x)
+		uniform = iter[x + t.y0 * stride] == first && iter[x + (t.y1 - 1) * stride] == first;
+	for (int y = t.y0 + 1; y < t.y1 - 1 && uniform; ++y)
+		uniform = iter[t.x0 + y * stride] == first && iter[t.x1 - 1 + y * stride] == first;
+
+	if (uniform) {
+		const float r2 = image.r2 ? image.r2[t.x0 + t.y0 * stride] : 0;
+		const float distance = image.distance ? image.distance[t.x0 + t.y0 * stride] : 0;
+		for (int y = t.y0 + 1; y < t.y1 - 1; ++y) {
+			for (int x = t.x0 + 1; x < t.x1 - 1; ++x) {
+				image.iter[x + y * stride] = first;
+				if (image.r2)
+					image.r2[x + y * stride] = r2;
+				if (image.distance)
+					image.distance[x + y * stride] = distance;
+			}
+		}
+		return written + (w - 2) * (h - 2);
+	}
+
+	// the cross is shared by the four quarters as part of their borders
+	const int mx = (t.x0 + t.x1) / 2;
+	const int my = (t.y0 + t.y1) / 2;
+	render(t.x0 + 1, my, t.x1 - 1, my + 1);
+	render(mx, t.y0 + 1, mx + 1, my);
+	render(mx, my + 1, mx + 1, t.y1 - 1);
+	written += (w - 2) + (h - 3);
+
+	const int d = t.depth + 1;
+	split.push_back({t.x0, t.y0, mx + 1, my + 1, d});
+	split.push_back({mx, t.y0, t.x1, my + 1, d});
+	split.push_back({t.x0, my, mx + 1, t.y1, d});
+	split.push_back({mx, my, t.x1, t.y1, d});
+	return written;
+}
@@ -0,0 +1,110 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <glad/gl.h>
+#include "render_service.h"
+
+// streams the published tiles of the frame on screen into its texture. the texture storage is only allocated
+// when the size changes, the tiles go in with glTexSubImage2D from a ring of pixel buffer objects, so the driver
+// copies from one while the next is filled and the main loop never waits for a transfer.
+
+// pixel buffers in flight
+constexpr int stream_ring = 3;
+
+class texture_stream {
+	public:
+	void init()
+	{
+		glGenTextures(1, &tex);
+		glEnable(GL_TEXTURE_2D);
+		glBindTexture(GL_TEXTURE_2D, tex);
+		glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glDisable(GL_TEXTURE_2D);
+		glGenBuffers(stream_ring, pbo);
+	}
+
+	GLuint texture() const { return tex; }
+
+	// uploads the tiles job published since the last call. the texture keeps what it showed everywhere else,
+	// the previous frame until the tiles of the new one cover it.
+	void upload(render_job &job)
+	{
+		const Image &image = job.image;
+		if (image.width != width || image.height != height)
+			allocate(image.width, image.height);
+
+		std::vector<Tile> tiles;
+		job.take_published([&](const uint8_t *colors, const std::vector<Tile> &published) {
+			long long area = 0;
+			for (const Tile &t : published)
+				area += (long long)(t.x1 - t.x0) * (t.y1 - t.y0);
+			// past half the frame one copy of all of it is cheaper than many small ones
+			if (area * 2 >= (long long)width * height) {
+				tiles.assign(1, {0, 0, width, height});
+				area = (long long)width * height;
+			} else {
+				tiles = published;
+			}
+
+			const size_t bytes = size_t(area) * 4;
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo[next]);
+			if (capacity[next] < bytes) {
+				glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+				capacity[next] = bytes;
+			}
+			// invalidating lets the driver hand out fresh memory if the last upload from this buffer is
+			// still running
+			const GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT;
+			auto *dst = static_cast<uint8_t *>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, access));
+			if (!dst) {
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+				tiles.clear();
+				return;
+			}
+			// tiles are packed one after the other, each with rows of its own width
+			for (const Tile &t : tiles) {
+				const size_t row = size_t(t.x1 - t.x0) * 4;
+				for (int y = t.y0; y < t.y1; ++y) {
+					memcpy(dst, colors + (size_t(y) * width + t.x0) * 4, row);
+					dst += row;
+				}
+			}
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		});
+		if (tiles.empty())
+			return;
+
+		glBindTexture(GL_TEXTURE_2D, tex);
+		size_t offset = 0;
+		for (const Tile &t : tiles) {
+			const int w = t.x1 - t.x0, h = t.y1 - t.y0;
+			glTexSubImage2D(GL_TEXTURE_2D, 0, t.x0, t.y0, w, h, GL_RGBA, GL_UNSIGNED_BYTE,
+			                reinterpret_cast<const void *>(offset));
+			offset += size_t(w) * h * 4;
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		next = (next + 1) % stream_ring;
+	}
+
+	private:
+	void allocate(int w, int h)
+	{
+		width = w;
+		height = h;
+		glBindTexture(GL_TEXTURE_2D, tex);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+
+	GLuint tex = 0;
+	GLuint pbo[stream_ring] = {};
+	size_t capacity[stream_ring] = {};
+	int next = 0;
+	int width = 0;
+	int height = 0;
+};
@@ -0,0 +1,297 @@
+#pragma once
+#include <stdint.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <array>
+#include <vector>
+#include "mandelbrot.h"
+
+// compact iteration data of the tile pyramid. every pixel is one integer, the escape iteration times 256 plus
+// its escape fraction in 8 bits, which changes smoothly across the bands. each is predicted from its left,
+// lower and lower left neighbors with the median edge detector of LOCO-I and the difference is Rice coded
+// with a parameter that follows the mean of the differences before. runs of a value along a row, the inside
+// of the set and flat outer areas, cost a few bits per run instead of one per pixel.
+
+// unary prefixes this long are followed by the raw difference
+constexpr int rice_limit = 24;
+
+// bits least significant first
+class bit_writer {
+	public:
+	explicit bit_writer(std::vector<uint8_t> &out) : out(out) {}
+
+	// n <= 32
+	void put(uint64_t bits, int n)
+	{
+		acc |= (bits & ((uint64_t(1) << n) - 1)) << count;
+		count += n;
+		while (count >= 8) {
+			out.push_back(uint8_t(acc));
+			acc >>= 8;
+			count -= 8;
+		}
+	}
+
+	void put_wide(uint64_t bits, int n)
+	{
+		if (n > 32) {
+			put(bits, 32);
+			bits >>= 32;
+			n -= 32;
+		}
+		put(bits, n);
+	}
+
+	void flush()
+	{
+		if (count > 0)
+			out.push_back(uint8_t(acc));
+		acc = 0;
+		count = 0;
+	}
+
+	private:
+	std::vector<uint8_t> &out;
+	uint64_t acc = 0;
+	int count = 0;
+};
+
+class bit_reader {
+	public:
+	bit_reader(const uint8_t *p, const uint8_t *end) : p(p), end(end) {}
+
+	// n <= 32, zeros past the end and overrun() is set
+	uint64_t get(int n)
+	{
+		while (count < n) {
+			uint64_t byte = 0;
+			if (p < end)
+				byte = *p++;
+			else
+				past_end = true;
+			acc |= byte << count;
+			count += 8;
+		}
+		const uint64_t bits = acc & ((uint64_t(1) << n) - 1);
+		acc >>= n;
+		count -= n;
+		return bits;
+	}
+
+	uint64_t get_wide(int n)
+	{
+		if (n <= 32)
+			return get(n);
+		const uint64_t low = get(32);
+		return low | get(n - 32) << 32;
+	}
+
+	bool overrun() const { return past_end; }
+
+	private:
+	const uint8_t *p;
+	const uint8_t *end;
+	uint64_t acc = 0;
+	int count = 0;
+	bool past_end = false;
+};
+
+// the Rice parameter of a stream, from the sum and count of its recent values
+struct rice_context {
+	uint64_t sum = 4;
+	int count = 1;
+
+	int k() const
+	{
+		int k = 0;
+		while ((uint64_t(count) << k) < sum && k < 62)
+			k++;
+		return k;
+	}
+
+	void update(uint64_t u)
+	{
+		sum += u;
+		if (++count == 64) {
+			sum >>= 1;
+			count >>= 1;
+		}
+	}
+};
+
+inline void put_rice(bit_writer &out, rice_context &c, uint64_t u)
+{
+	const int k = c.k();
+	const uint64_t q = u >> k;
+	if (q < rice_limit) {
+		out.put((uint64_t(1) << q) - 1, int(q) + 1);
+		out.put_wide(u, k);
+	} else {
+		out.put((uint64_t(1) << rice_limit) - 1, rice_limit);
+		out.put_wide(u, 64);
+	}
+	c.update(u);
+}
+
+inline uint64_t get_rice(bit_reader &in, rice_context &c)
+{
+	const int k = c.k();
+	uint64_t q = 0;
+	while (q < rice_limit && in.get(1))
+		q++;
+	const uint64_t u = q < rice_limit ? q << k | in.get_wide(k) : in.get_wide(64);
+	c.update(u);
+	return u;
+}
+
+inline uint64_t zigzag(int64_t d) { return (uint64_t(d) << 1) ^ uint64_t(d >> 63); }
+inline int64_t unzigzag(uint64_t u) { return int64_t(u >> 1) ^ -int64_t(u & 1); }
+
+// LOCO-I prediction from the left neighbor a, the lower one b and the lower left one c
+inline int64_t median_edge(int64_t a, int64_t b, int64_t c)
+{
+	if (c >= std::max(a, b))
+		return std::min(a, b);
+	if (c <= std::min(a, b))
+		return std::max(a, b);
+	return a + b - c;
+}
+
+// the neighbors of pixel x of a row, a row or column outside the tile repeats the one inside
+inline void neighbors(const int64_t *row, const int64_t *below, int x, int64_t &a, int64_t &b, int64_t &c)
+{
+	if (!below) {
+		a = x > 0 ? row[x - 1] : 0;
+		b = c = a;
+	} else if (x == 0) {
+		a = b = c = below[0];
+	} else {
+		a = row[x - 1];
+		b = below[x];
+		c = below[x - 1];
+	}
+}
+
+// the value the codec stores for a pixel, see above
+inline int64_t tile_value(int iter, float r2, int n)
+{
+	if (iter >= n)
+		return int64_t(n) << 8;
+	const int q = std::min(255, int(escape_fraction(r2) * 256));
+	return int64_t(iter) << 8 | q;
+}
+
+// r2 that gives back the stored escape fraction, the middle of its 8 bit step
+inline float tile_r2(int q)
+{
+	static const auto table = [] {
+		std::array<float, 256> t;
+		for (int i = 0; i < 256; ++i)
+			t[i] = float(exp2(exp2(2 - (i + 0.5) / 256)));
+		return t;
+	}();
+	return table[q];
+}
+
+constexpr uint8_t tile_magic[4] = {'M', 'B', 'T', '1'};
+
+// the width x height pixels of iter and r2, computed with n iterations. r2 may be null, the tile then has no
+// escape fractions.
+inline std::vector<uint8_t> encode_tile(const int *iter, const float *r2, int width, int height, int n)
+{
+	std::vector<uint8_t> out(tile_magic, tile_magic + 4);
+	auto put32 = [&out](uint32_t v) {
+		for (int i = 0; i < 4; ++i)
+			out.push_back(uint8_t(v >> 8 * i));
+	};
+	put32(width);
+	put32(height);
+	put32(n);
+
+	std::vector<int64_t> values(size_t(width) * height);
+	for (size_t i = 0; i < values.size(); ++i)
+		values[i] = tile_value(iter[i], r2 ? r2[i] : 16.0f, n);
+
+	bit_writer bits(out);
+	rice_context pixels, runs;
+	for (int y = 0; y < height; ++y) {
+		const int64_t *row = values.data() + size_t(y) * width;
+		const int64_t *below = y > 0 ? row - width : nullptr;
+		int x = 0;
+		while (x < width) {
+			int64_t a, b, c;
+			neighbors(row, below, x, a, b, c);
+			if (a == b && b == c) {
+				// a run of a, the pixel that ends it before the end of the row follows as usual
+				int end = x;
+				while (end < width && row[end] == a)
+					end++;
+				put_rice(bits, runs, end - x);
+				x = end;
+				if (x == width)
+					break;
+				neighbors(row, below, x, a, b, c);
+			}
+			put_rice(bits, pixels, zigzag(row[x] - median_edge(a, b, c)));
+			x++;
+		}
+	}
+	bits.flush();
+	return out;
+}
+
+// the pixels of a tile encode_tile() wrote into iter and r2, which may be null. false when the data is not a
+// tile of width x height pixels and n iterations or is damaged, iter and r2 are garbage then.
+inline bool decode_tile(const std::vector<uint8_t> &data, int *iter, float *r2, int width, int height, int n)
+{
+	if (data.size() < 16 || memcmp(data.data(), tile_magic, 4))
+		return false;
+	auto get32 = [&data](int at) {
+		uint32_t v = 0;
+		for (int i = 0; i < 4; ++i)
+			v |= uint32_t(data[at + i]) << 8 * i;
+		return v;
+	};
+	if (get32(4) != uint32_t(width) || get32(8) != uint32_t(height) || get32(12) != uint32_t(n))
+		return false;
+
+	const int64_t inside = int64_t(n) << 8;
+	std::vector<int64_t> values(size_t(width) * height);
+	bit_reader bits(data.data() + 16, data.data() + data.size());
+	rice_context pixels, runs;
+	for (int y = 0; y < height; ++y) {
+		int64_t *row = values.data() + size_t(y) * width;
+		const int64_t *below = y > 0 ? row - width : nullptr;
+		int x = 0;
+		while (x < width) {
+			int64_t a, b, c;
+			neighbors(row, below, x, a, b, c);
+			if (a == b && b == c) {
+				const uint64_t run = get_rice(bits, runs);
+				if (run > uint64_t(width - x))
+					return false;
+				std::fill(row + x, row + x + run, a);
+				x += int(run);
+				if (x == width)
+					break;
+				neighbors(row, below, x, a, b, c);
+			}
+			// wrapping, damaged data must not overflow. the values stay in range for the predictions after
+			row[x] = int64_t(uint64_t(median_edge(a, b, c)) + uint64_t(unzigzag(get_rice(bits, pixels))));
+			if (row[x] < 0 || row[x] > inside)
+				return false;
+			x++;
+		}
+		if (bits.overrun())
+			return false;
+	}
+
+	for (size_t i = 0; i < values.size(); ++i) {
+		const int64_t v = values[i];
+		iter[i] = int(v >> 8);
+		if (r2)
+			r2[i] = v == inside ? 0.0f : tile_r2(int(v & 255));
+	}
+	return true;
+}
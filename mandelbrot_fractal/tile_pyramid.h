@@ -0,0 +1,322 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <filesystem>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "coloring.h"
+#include "mandelbrot.h"
+#include "pool.h"
+#include "render.h"
+#include "tile_codec.h"
+
+// a quadtree of tile_pixels square tiles over [-2, 2] x [-2, 2]. level 0 is one tile, every level halves the
+// tiles of the one above. views whose pixels are pixels of a level are assembled from cached tiles, only the
+// missing tiles are computed, and those are kept for the next view. the tiles hold iterations and escape
+// fractions, in memory up to a budget and without limit in a directory.
+
+constexpr int tile_pixels = 256;
+// the pixel coordinates of the deepest level still fit in 64 bits, the pixels are 2^-58 apart there
+constexpr int pyramid_max_level = 52;
+
+// a view of the pyramid by its level and the pixel of that level at its lower left corner. columns count from
+// -2 on the real axis, rows from -2 on the imaginary axis, both may leave the square.
+struct PyramidView {
+	int level = 0;
+	long long column = 0;
+	long long row = 0;
+};
+
+// columns and rows up to this far outside the square are allowed
+inline long long pyramid_reach(int level) { return 1ll << (level + 8); }
+
+// rounds towards minus infinity, tile coordinates of negative pixels
+inline long long floor_div(long long a, long long b) { return a >= 0 ? a / b : -((-a + b - 1) / b); }
+
+// k / 2^e as an exact decimal, every dyadic fraction has one
+inline std::string dyadic_decimal(long long k, int e)
+{
+	const bool negative = k < 0;
+	unsigned long long m = negative ? 0ull - (unsigned long long)k : (unsigned long long)k;
+	// m * 5^e, little endian decimal digits
+	std::vector<int> digits;
+	do {
+		digits.push_back(int(m % 10));
+		m /= 10;
+	} while (m);
+	for (int i = 0; i < e; ++i) {
+		int carry = 0;
+		for (int &d : digits) {
+			const int v = d * 5 + carry;
+			d = v % 10;
+			carry = v / 10;
+		}
+		if (carry)
+			digits.push_back(carry);
+	}
+	while ((int)digits.size() <= e)
+		digits.push_back(0);
+	std::string s = negative ? "-" : "";
+	for (int i = (int)digits.size() - 1; i >= 0; --i) {
+		s += char('0' + digits[i]);
+		if (i == e && e > 0)
+			s += '.';
+	}
+	return s;
+}
+
+// the location of a view of width x height pixels of the pyramid, exact at every precision that resolves it
+inline Location pyramid_location(const PyramidView &v, int width, int height)
+{
+	// pixels are 2^-(level + 6) apart, the center lies half a view from the corner
+	const long long half = 1ll << (v.level + 8);
+	Location at;
+	at.x = dyadic_decimal(2 * v.column + width - half, v.level + 7);
+	at.y = dyadic_decimal(2 * v.row + height - half, v.level + 7);
+	at.extent = dyadic_decimal(width, v.level + 6);
+	return at;
+}
+
+// false for a level outside the pyramid or pixels too far outside the square
+inline bool pyramid_valid(const PyramidView &v, int width, int height)
+{
+	if (v.level < 0 || v.level > pyramid_max_level)
+		return false;
+	const long long reach = pyramid_reach(v.level);
+	return v.column >= -reach && v.row >= -reach && v.column + width <= 2 * reach && v.row + height <= 2 * reach;
+}
+
+// everything the pixels of a tile depend on
+struct TileKey {
+	FormulaParams formula;
+	Precision precision = Precision::Double;
+	int n = 0;
+	int level = 0;
+	long long x = 0;
+	long long y = 0;
+
+	// path of the tile in a store, different for every key
+	std::string path() const
+	{
+		char f[128];
+		const char *name = formula_names[static_cast<int>(formula.formula)];
+		if (formula.formula == Formula::Julia)
+			snprintf(f, sizeof(f), "%s_%.17g_%.17g", name, formula.cx, formula.cy);
+		else if (formula.formula == Formula::Multibrot)
+			snprintf(f, sizeof(f), "%s_%d", name, formula.degree);
+		else
+			snprintf(f, sizeof(f), "%s", name);
+		char p[256];
+		const char *precision_name = precision_names[static_cast<int>(precision)];
+		snprintf(p, sizeof(p), "%s/%s/n%d/%d/%lld/%lld.tile", f, precision_name, n, level, x, y);
+		return p;
+	}
+};
+
+// encoded tiles, the most recently used ones in memory up to memory_bytes in front of a directory that keeps
+// all of them. safe to use from several threads.
+class tile_cache {
+	public:
+	// an empty dir keeps the tiles in memory only
+	tile_cache(std::string dir, size_t memory_bytes) : dir(std::move(dir)), budget(memory_bytes) {}
+
+	// the encoded tile of key, false when it was never stored
+	bool get(const TileKey &key, std::vector<uint8_t> &data)
+	{
+		const std::string path = key.path();
+		{
+			std::lock_guard<std::mutex> hold(lock);
+			auto it = index.find(path);
+			if (it != index.end()) {
+				lru.splice(lru.begin(), lru, it->second);
+				data = it->second->second;
+				memory_hits++;
+				return true;
+			}
+		}
+		if (dir.empty() || !read_file(dir + "/" + path, data)) {
+			misses++;
+			return false;
+		}
+		disk_hits++;
+		remember(path, data);
+		return true;
+	}
+
+	void put(const TileKey &key, const std::vector<uint8_t> &data)
+	{
+		const std::string path = key.path();
+		remember(path, data);
+		if (!dir.empty() && !write_file(dir + "/" + path, data))
+			fprintf(stderr, "can't store tile %s in %s\n", path.c_str(), dir.c_str());
+	}
+
+	// bytes of the tiles in memory
+	size_t memory_used()
+	{
+		std::lock_guard<std::mutex> hold(lock);
+		return bytes;
+	}
+
+	std::atomic<long long> memory_hits{0};
+	std::atomic<long long> disk_hits{0};
+	std::atomic<long long> misses{0};
+
+	private:
+	void remember(const std::string &path, const std::vector<uint8_t> &data)
+	{
+		std::lock_guard<std::mutex> hold(lock);
+		auto it = index.find(path);
+		if (it != index.end()) {
+			bytes -= it->second->second.size();
+			lru.erase(it->second);
+			index.erase(it);
+		}
+		lru.emplace_front(path, data);
+		index[path] = lru.begin();
+		bytes += data.size();
+		while (bytes > budget && !lru.empty()) {
+			bytes -= lru.back().second.size();
+			index.erase(lru.back().first);
+			lru.pop_back();
+		}
+	}
+
+	static bool read_file(const std::string &path, std::vector<uint8_t> &data)
+	{
+		FILE *f = fopen(path.c_str(), "rb");
+		if (!f)
+			return false;
+		data.clear();
+		uint8_t chunk[65536];
+		size_t got;
+		while ((got = fread(chunk, 1, sizeof(chunk), f)) > 0)
+			data.insert(data.end(), chunk, chunk + got);
+		const bool ok = !ferror(f);
+		fclose(f);
+		return ok;
+	}
+
+	// through a file of its own that is renamed over the tile, readers never see half a tile
+	static bool write_file(const std::string &path, const std::vector<uint8_t> &data)
+	{
+		std::error_code error;
+		std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+		const std::string temporary =
+		    path + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+		FILE *f = fopen(temporary.c_str(), "wb");
+		if (!f)
+			return false;
+		bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+		ok = fclose(f) == 0 && ok;
+		if (ok)
+			std::filesystem::rename(temporary, path, error);
+		if (!ok || error)
+			std::filesystem::remove(temporary, error);
+		return ok && !error;
+	}
+
+	std::string dir;
+	size_t budget;
+	std::mutex lock;
+	// most recently used first
+	std::list<std::pair<std::string, std::vector<uint8_t>>> lru;
+	std::unordered_map<std::string, std::list<std::pair<std::string, std::vector<uint8_t>>>::iterator> index;
+	size_t bytes = 0;
+};
+
+// the iterations and r2 of image, a view of the pyramid at v, from the tiles of cache. the missing tiles are
+// computed in one batch and stored. the distances of the image are left alone, the tiles have none. false
+// when a tile location does not parse at the precision, which pyramid_valid() views never do. tiles of an
+// image cancelled while they render are not stored.
+inline bool render_pyramid(Image &image, const PyramidView &v, Precision precision, int n,
+                           const FormulaParams &formula, tile_cache &cache, pool &workers, int nthreads)
+{
+	PROF;
+	const int tile_size = tile_pixels * tile_pixels;
+	const long long x0 = floor_div(v.column, tile_pixels), x1 = floor_div(v.column + image.width - 1, tile_pixels);
+	const long long y0 = floor_div(v.row, tile_pixels), y1 = floor_div(v.row + image.height - 1, tile_pixels);
+
+	// copies the part of tile (x, y) inside the view
+	auto place = [&](long long x, long long y, const int *iter, const float *r2) {
+		const long long left = x * tile_pixels - v.column, bottom = y * tile_pixels - v.row;
+		const int sx = int(std::max(0ll, -left)), dx = int(std::max(0ll, left));
+		const int count = int(std::min<long long>(tile_pixels - sx, image.width - dx));
+		for (int sy = int(std::max(0ll, -bottom)); sy < tile_pixels; ++sy) {
+			const long long dy = bottom + sy;
+			if (dy >= image.height)
+				break;
+			const size_t src = size_t(sy) * tile_pixels + sx, dst = size_t(dy) * image.width + dx;
+			std::copy(iter + src, iter + src + count, image.iter + dst);
+			if (image.r2)
+				std::copy(r2 + src, r2 + src + count, image.r2 + dst);
+		}
+	};
+
+	std::vector<TileKey> keys;
+	for (long long y = y0; y <= y1; ++y) {
+		for (long long x = x0; x <= x1; ++x) {
+			TileKey key;
+			key.formula = formula;
+			key.precision = precision;
+			key.n = n;
+			key.level = v.level;
+			key.x = x;
+			key.y = y;
+			keys.push_back(key);
+		}
+	}
+
+	// the cached tiles are read and decoded on threads of their own, they place disjoint parts of the view
+	std::vector<uint8_t> found(keys.size());
+	parallel_bands(workers, (int)keys.size(), nthreads, [&](int begin, int end, int) {
+		std::vector<uint8_t> data;
+		std::vector<int> iter(tile_size);
+		std::vector<float> r2(tile_size);
+		for (int i = begin; i < end; ++i) {
+			const bool hit = cache.get(keys[i], data);
+			found[i] = hit && decode_tile(data, iter.data(), r2.data(), tile_pixels, tile_pixels, n);
+			if (found[i])
+				place(keys[i].x, keys[i].y, iter.data(), r2.data());
+		}
+	});
+	std::vector<TileKey> missing;
+	for (size_t i = 0; i < keys.size(); ++i)
+		if (!found[i])
+			missing.push_back(keys[i]);
+	if (missing.empty())
+		return true;
+
+	const int count = (int)missing.size();
+	std::vector<int> missing_iter(size_t(count) * tile_size);
+	std::vector<float> missing_r2(size_t(count) * tile_size);
+	std::vector<Image> images(count);
+	std::vector<Location> at(count);
+	for (int i = 0; i < count; ++i) {
+		images[i].iter = missing_iter.data() + size_t(i) * tile_size;
+		images[i].r2 = missing_r2.data() + size_t(i) * tile_size;
+		images[i].width = tile_pixels;
+		images[i].height = tile_pixels;
+		images[i].cancel = image.cancel;
+		at[i] = pyramid_location({v.level, missing[i].x * tile_pixels, missing[i].y * tile_pixels}, tile_pixels,
+		                         tile_pixels);
+	}
+	if (!render_locations(images.data(), at.data(), count, precision, n, workers, nthreads, nullptr, formula))
+		return false;
+	const bool complete = !cancelled(image);
+	parallel_bands(workers, count, nthreads, [&](int begin, int end, int) {
+		for (int i = begin; i < end; ++i) {
+			const Image &t = images[i];
+			if (complete)
+				cache.put(missing[i], encode_tile(t.iter, t.r2, tile_pixels, tile_pixels, n));
+			place(missing[i].x, missing[i].y, t.iter, t.r2);
+		}
+	});
+	return true;
+}
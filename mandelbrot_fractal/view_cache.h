@@ -0,0 +1,215 @@
+#pragma once
+#include <math.h>
+#include <list>
+#include <vector>
+#include "mandelbrot.h"
+#include "pool.h"
+
+// iteration buffers of the last finished frames. a new view that overlaps one of them starts from a
+// preview resampled from it and only computes the pixels that do not lie exactly on one of its samples.
+// the x and y mappings are independent, so the exact pixels are the product of a set of columns and a set
+// of rows.
+
+constexpr int view_cache_size = 8;
+// a pixel closer than this to a cached sample, in pixels, is that sample
+constexpr double view_exact_tolerance = 1e-6;
+
+struct View {
+	Rect<fp> rect;
+	int precision;
+	int n;
+	int width;
+	int height;
+	std::vector<int> iter;
+	// empty when the image had no r2 buffer
+	std::vector<float> r2;
+};
+
+// how the pixels of a new view map onto a cached one
+struct Reuse {
+	const View *view = nullptr;
+	// exact source column and row of every pixel, -1 when there is none
+	std::vector<int> cols;
+	std::vector<int> rows;
+	// nearest source column and row for the preview, -1 outside the cached view
+	std::vector<int> near_cols;
+	std::vector<int> near_rows;
+	long long exact = 0;
+
+	bool complete() const { return exact == (long long)cols.size() * (long long)rows.size(); }
+};
+
+class view_cache {
+	public:
+	// parameters of the frame being rendered, stored by finish() once it is done
+	void begin(const Rect<fp> &rect, int precision, int n)
+	{
+		next.rect = rect;
+		next.precision = precision;
+		next.n = n;
+	}
+
+	void finish(const Image &image)
+	{
+		for (auto it = views.begin(); it != views.end(); ++it) {
+			if (same(*it, next, image.width, image.height)) {
+				views.splice(views.begin(), views, it);
+				return;
+			}
+		}
+		if ((int)views.size() == view_cache_size)
+			views.pop_back();
+		View v = next;
+		v.width = image.width;
+		v.height = image.height;
+		v.iter.assign(image.iter, image.iter + image.width * image.height);
+		if (image.r2)
+			v.r2.assign(image.r2, image.r2 + image.width * image.height);
+		views.push_front(std::move(v));
+	}
+
+	void clear() { views.clear(); }
+
+	// the cached view of the same precision and iterations with the most exact samples of r
+	template <typename T> Reuse plan(const Rect<T> &r, int precision, int n, int width, int height) const
+	{
+		Reuse best;
+		for (const View &v : views) {
+			if (v.precision != precision || v.n != n || v.width != width || v.height != height ||
+			    v.rect.x0.index() != fp(r.x0).index())
+				continue;
+			Reuse reuse;
+			reuse.view = &v;
+			const Rect<T> old = collapse<T>(v.rect);
+			map(reuse.cols, reuse.near_cols, r.x0, r.x1, old.x0, old.x1, width);
+			map(reuse.rows, reuse.near_rows, r.y0, r.y1, old.y0, old.y1, height);
+			long long c = 0, l = 0;
+			for (int s : reuse.cols)
+				c += s >= 0;
+			for (int s : reuse.rows)
+				l += s >= 0;
+			reuse.exact = c * l;
+			if (!best.view || reuse.exact > best.exact)
+				best = std::move(reuse);
+		}
+		return best;
+	}
+
+	private:
+	static bool same(const View &a, const View &b, int width, int height)
+	{
+		return a.width == width && a.height == height && a.precision == b.precision && a.n == b.n &&
+		       a.rect.x0 == b.rect.x0 && a.rect.x1 == b.rect.x1 && a.rect.y0 == b.rect.y0 &&
+		       a.rect.y1 == b.rect.y1;
+	}
+
+	// pixel i of [a0, a1) lies at offset + i * ratio in pixels of [b0, b1)
+	template <typename T>
+	static void map(std::vector<int> &exact, std::vector<int> &near, const T &a0, const T &a1, const T &b0,
+	                const T &b1, int size)
+	{
+		const T scale = (b1 - b0) / size;
+		const double offset = e<double>((a0 - b0) / scale);
+		const double ratio = e<double>((a1 - a0) / (b1 - b0));
+		exact.assign(size, -1);
+		near.assign(size, -1);
+		for (int i = 0; i < size; ++i) {
+			double p = offset + i * ratio;
+			double k = floor(p + 0.5);
+			if (k < 0 || k >= size)
+				continue;
+			near[i] = (int)k;
+			if (fabs(p - k) < view_exact_tolerance)
+				exact[i] = (int)k;
+		}
+	}
+
+	View next;
+	std::list<View> views;
+};
+
+// fills the iterations of the whole image from the cached view, nearest sample, missing outside of it
+inline void preview(Image &image, const Reuse &reuse)
+{
+	const View &v = *reuse.view;
+	const bool r2 = image.r2 && !v.r2.empty();
+	for (int y = 0; y < image.height; ++y) {
+		const int sy = reuse.near_rows[y];
+		for (int x = 0; x < image.width; ++x) {
+			const int sx = reuse.near_cols[x];
+			const int idx = x + y * image.width;
+			const bool inside = sx >= 0 && sy >= 0;
+			image.iter[idx] = inside ? v.iter[sx + sy * v.width] : -1;
+			if (r2)
+				image.r2[idx] = inside ? v.r2[sx + sy * v.width] : 0;
+		}
+	}
+}
+
+// true when the columns of [x0, x1) without a sample are evenly spaced single pixels, as zooming in by
+// two leaves them
+inline bool evenly_spaced_holes(const Reuse &reuse, int x0, int x1, int &first, int &step)
+{
+	first = -1;
+	step = 0;
+	for (int x = x0; x < x1; ++x) {
+		if (reuse.cols[x] >= 0)
+			continue;
+		if (first < 0)
+			first = x;
+		else if (step == 0)
+			step = x - first;
+		else if ((x - first) % step != 0)
+			return false;
+	}
+	if (first < 0 || step == 0)
+		return false;
+	for (int x = first; x < x1; x += step)
+		if (reuse.cols[x] >= 0)
+			return false;
+	return step > 1;
+}
+
+// computes the pixels of the tile without an exact sample, render(left, top, right, bottom, xstep, ystep)
+// as in progressive_pass. consecutive rows without samples go in one call. returns the number of pixels
+// computed.
+template <typename F> int reuse_tile(const Tile &t, const Reuse &reuse, F &&render)
+{
+	int first, step;
+	const bool spaced = evenly_spaced_holes(reuse, t.x0, t.x1, first, step);
+
+	int written = 0;
+	int y = t.y0;
+	while (y < t.y1) {
+		if (reuse.rows[y] < 0) {
+			int end = y;
+			while (end < t.y1 && reuse.rows[end] < 0)
+				end++;
+			render(t.x0, y, t.x1, end, 1, 1);
+			written += (t.x1 - t.x0) * (end - y);
+			y = end;
+			continue;
+		}
+		if (spaced) {
+			render(first, y, t.x1, y + 1, step, 1);
+			written += (t.x1 - first + step - 1) / step;
+			y++;
+			continue;
+		}
+		int x = t.x0;
+		while (x < t.x1) {
+			if (reuse.cols[x] >= 0) {
+				x++;
+				continue;
+			}
+			int end = x;
+			while (end < t.x1 && reuse.cols[end] < 0)
+				end++;
+			render(x, y, end, y + 1, 1, 1);
+			written += end - x;
+			x = end;
+		}
+		y++;
+	}
+	return written;
+}
@@ -0,0 +1,489 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <array>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "debugging.h"
+#include "mandelbrot.h"
+#include "pool.h"
+#include "palette.h"
+#include "coloring.h"
+#include "render.h"
+#include "image_file.h"
+
+using namespace std;
+
+// renders a zoom animation through keyframes, the rectangles the viewer saves from its zoom history, one
+// "x0 x1 y0 y1" per line. between two keyframes the view shrinks exponentially towards the point that
+// both keep at the same place, so every frame of a segment lies inside the ones before it. such a segment
+// is rendered as one shot of twice the frame size per halving of the view and every frame is resampled
+// from the last shot at least as large as itself. segments that do not nest render every frame.
+
+struct Options {
+	int width = 1280;
+	int height = 720;
+	Precision precision = Precision::Double;
+	int iterations = 1024;
+	Coloring coloring = Coloring::Smooth;
+	FormulaParams formula;
+	int frames_per_doubling = 30;
+	// shots rendered in one batch
+	int in_flight = 2;
+	int nthreads = (int)thread::hardware_concurrency();
+	// printf pattern of the frame files, - streams raw RGB frames to stdout
+	string output;
+};
+
+// one rendered image and the frames taken from it
+struct Shot {
+	// 2 for the oversized shots of a nested segment, 1 for a frame rendered as is
+	int scale = 1;
+	// the point of the shot that stays in place while zooming, in fractions of its width and height
+	double u = 0.5;
+	double v = 0.5;
+	// every frame shows this fraction of the shot's width and height around (u, v)
+	vector<double> frames;
+};
+
+// shots are handed from the renderer to the writer and back in slots
+struct Slot {
+	vector<uint8_t> buf;
+	vector<int> iter;
+	vector<float> r2;
+	// only for the distance coloring
+	vector<float> distance;
+	Image image;
+	Shot shot;
+	double render_time = 0;
+};
+
+template <typename V> class channel {
+	public:
+	void push(V v)
+	{
+		{
+			lock_guard<mutex> lock(m);
+			items.push_back(v);
+		}
+		ready.notify_one();
+	}
+
+	// false once the channel is closed and empty
+	bool pop(V &v)
+	{
+		unique_lock<mutex> lock(m);
+		ready.wait(lock, [this] { return !items.empty() || closed; });
+		if (items.empty())
+			return false;
+		v = items.front();
+		items.pop_front();
+		return true;
+	}
+
+	void close()
+	{
+		{
+			lock_guard<mutex> lock(m);
+			closed = true;
+		}
+		ready.notify_all();
+	}
+
+	private:
+	mutex m;
+	condition_variable ready;
+	deque<V> items;
+	bool closed = false;
+};
+
+// a sample position along one axis of a shot, between pixels i and i + 1 by f
+struct Tap {
+	int i;
+	float f;
+};
+
+// the samples of frame pixels 0..size-1 along an axis, two per pixel at its quarters. pixel x shows the shot
+// at offset + (x + 0.5) * step.
+static vector<Tap> taps(int size, int shot_size, double offset, double step)
+{
+	vector<Tap> t(2 * size);
+	for (int x = 0; x < size; ++x) {
+		for (int k = 0; k < 2; ++k) {
+			double p = min(max(offset + (x + 0.25 + 0.5 * k) * step, 0.0), shot_size - 1.0);
+			int i = min((int)p, max(shot_size - 2, 0));
+			t[2 * x + k] = {i, float(p - i)};
+		}
+	}
+	return t;
+}
+
+// frame pixel (x, y) shows the shot at u + ((x + 0.5) / width - u) * fraction, v likewise. every frame
+// pixel covers one to two shot pixels, it averages the bilinear samples at its four quarters.
+static void resample(const Image &shot, double u, double v, double fraction, Image &frame, pool &workers,
+                     int nthreads)
+{
+	if (fraction == 1 && shot.width == frame.width && shot.height == frame.height) {
+		memcpy(frame.buf, shot.buf, size_t(frame.width) * frame.height * 4);
+		return;
+	}
+	const vector<Tap> xs = taps(frame.width, shot.width, u * shot.width * (1 - fraction) - 0.5,
+	                            fraction * shot.width / frame.width);
+	const vector<Tap> ys = taps(frame.height, shot.height, v * shot.height * (1 - fraction) - 0.5,
+	                            fraction * shot.height / frame.height);
+	const int dx = shot.width > 1 ? 4 : 0;
+	const size_t dy = shot.height > 1 ? size_t(shot.width) * 4 : 0;
+	parallel_bands(workers, frame.height, nthreads, [&](int y0, int y1, int) {
+		for (int y = y0; y < y1; ++y) {
+			uint8_t *row = frame.buf + size_t(y) * frame.width * 4;
+			for (int x = 0; x < frame.width; ++x) {
+				float rgb[3] = {0, 0, 0};
+				for (int k = 0; k < 4; ++k) {
+					const Tap tx = xs[2 * x + (k & 1)];
+					const Tap ty = ys[2 * y + (k >> 1)];
+					const uint8_t *p = shot.buf + (size_t(ty.i) * shot.width + tx.i) * 4;
+					for (int c = 0; c < 3; ++c) {
+						const float top = p[c] + (p[dx + c] - p[c]) * tx.f;
+						const float bottom = p[dy + c] + (p[dy + dx + c] - p[dy + c]) * tx.f;
+						rgb[c] += top + (bottom - top) * ty.f;
+					}
+				}
+				for (int c = 0; c < 3; ++c)
+					row[4 * x + c] = uint8_t(rgb[c] * 0.25f + 0.5f);
+				row[4 * x + 3] = 0;
+			}
+		}
+	});
+}
+
+template <typename T> static bool inside(const Rect<T> &a, const Rect<T> &b)
+{
+	return a.x0 >= b.x0 && a.x1 <= b.x1 && a.y0 >= b.y0 && a.y1 <= b.y1;
+}
+
+// a + (b - a) * w for every corner
+template <typename T> static Rect<T> between(const Rect<T> &a, const Rect<T> &b, double w)
+{
+	const T t = T(w);
+	return {a.x0 + (b.x0 - a.x0) * t, a.x1 + (b.x1 - a.x1) * t, a.y0 + (b.y0 - a.y0) * t, a.y1 + (b.y1 - a.y1) * t};
+}
+
+// the shots of the animation through keys, in the order of their frames
+template <typename T> static vector<pair<Rect<T>, Shot>> plan(const vector<Rect<T>> &keys, int frames_per_doubling)
+{
+	vector<pair<Rect<T>, Shot>> shots;
+	for (size_t i = 0; i + 1 < keys.size(); ++i) {
+		const Rect<T> &a = keys[i];
+		const Rect<T> &b = keys[i + 1];
+		// the width shrinks by k over the segment, a corner at s is a + (b - a) (1 - k^s) / (1 - k)
+		const double k = e<double>((b.x1 - b.x0) / (a.x1 - a.x0));
+		const double depth = -log2(k);
+		const int frames = max(1, (int)lround(fabs(depth) * frames_per_doubling));
+		const bool nested = depth > 1e-9 && inside(b, a);
+		auto weight = [k](double s) { return fabs(1 - k) < 1e-12 ? s : (1 - pow(k, s)) / (1 - k); };
+
+		if (!nested) {
+			for (int j = 0; j < frames; ++j) {
+				Shot shot;
+				shot.frames = {1.0};
+				shots.push_back({between(a, b, weight(double(j) / frames)), shot});
+			}
+			continue;
+		}
+
+		// the fixed point p has a + (b - a) / (1 - k) as its corners
+		const double u = e<double>((b.x0 - a.x0) / ((a.x1 - a.x0) - (b.x1 - b.x0)));
+		const double v = e<double>((b.y0 - a.y0) / ((a.y1 - a.y0) - (b.y1 - b.y0)));
+		// shot m shows the view halved m times with twice the pixels of a frame
+		auto shot_rect = [&](int m) { return between(a, b, (1 - pow(2.0, -m)) / (1 - k)); };
+		int current = -1;
+		for (int j = 0; j < frames; ++j) {
+			const double d = depth * j / frames;
+			const int m = (int)floor(d);
+			if (m != current) {
+				Shot shot;
+				shot.scale = 2;
+				shot.u = u;
+				shot.v = v;
+				shots.push_back({shot_rect(m), shot});
+				current = m;
+			}
+			shots.back().second.frames.push_back(pow(2.0, -(d - m)));
+		}
+	}
+	Shot last;
+	last.frames = {1.0};
+	shots.push_back({keys.back(), last});
+	return shots;
+}
+
+template <typename T> static int animate(const Options &o, const vector<array<string, 4>> &text, bool perturbed)
+{
+	vector<Rect<T>> keys;
+	for (const auto &k : text) {
+		string s[4];
+		for (int i = 0; i < 4; ++i) {
+			if (!plain_decimal(k[i], s[i])) {
+				fprintf(stderr, "bad keyframe coordinate %s\n", k[i].c_str());
+				return 1;
+			}
+		}
+		// centered on the keyframe with the aspect ratio of the frames
+		const Rect<T> r = {from_decimal<T>(s[0]), from_decimal<T>(s[1]), from_decimal<T>(s[2]), from_decimal<T>(s[3])};
+		const T cy = (r.y0 + r.y1) / T(2);
+		const T h = (r.x1 - r.x0) * T(o.height) / T(o.width);
+		keys.push_back({r.x0, r.x1, cy - h / T(2), cy + h / T(2)});
+	}
+	const vector<pair<Rect<T>, Shot>> shots = plan(keys, o.frames_per_doubling);
+
+	const size_t largest = size_t(2 * o.width) * (2 * o.height);
+	vector<Slot> slots(2 * o.in_flight);
+	channel<Slot *> free_slots, ready;
+	for (Slot &s : slots) {
+		s.buf.resize(largest * 4);
+		s.iter.resize(largest);
+		s.r2.resize(largest);
+		if (o.coloring == Coloring::Distance && o.formula.formula == Formula::Mandelbrot)
+			s.distance.resize(largest);
+		free_slots.push(&s);
+	}
+
+	// colors the shots and writes their frames while the next shots render
+	int written = 0;
+	atomic<bool> failed{false};
+	thread writer([&] {
+		Palette palette;
+		palette.coloring = o.coloring;
+		histogram hist;
+		// the render workers are busy with the next shots
+		pool coloring_workers;
+		vector<uint8_t> buf(size_t(o.width) * o.height * 4);
+		vector<uint8_t> rgb(size_t(o.width) * 3);
+		Image frame;
+		frame.buf = buf.data();
+		frame.buf_size = buf.size();
+		frame.width = o.width;
+		frame.height = o.height;
+		Slot *s;
+		while (ready.pop(s)) {
+			const double t0 = Profiler::get();
+			colorize_frame(s->image, o.iterations, palette, hist, coloring_workers, o.nthreads);
+			for (double fraction : s->shot.frames) {
+				resample(s->image, s->shot.u, s->shot.v, fraction, frame, coloring_workers, o.nthreads);
+				if (o.output == "-") {
+					for (int y = 0; y < frame.height; ++y) {
+						rgb_row(frame, y, rgb.data());
+						if (fwrite(rgb.data(), 1, rgb.size(), stdout) != rgb.size())
+							failed = true;
+					}
+				} else {
+					char name[4096];
+					snprintf(name, sizeof(name), o.output.c_str(), written);
+					if (!write_image(frame, name))
+						failed = true;
+				}
+				written++;
+			}
+			fprintf(stderr, "%dx%d shot: render %.3fs, %zu frames in %.3fs, %d written\n", s->image.width,
+			        s->image.height, s->render_time, s->shot.frames.size(), Profiler::get() - t0, written);
+			free_slots.push(s);
+		}
+	});
+
+	pool workers;
+	const double begin = Profiler::get();
+	vector<Slot *> batch;
+	vector<Image> images;
+	vector<Rect<T>> rects;
+	for (size_t i = 0; i < shots.size() && !failed; i += batch.size()) {
+		batch.clear();
+		images.clear();
+		rects.clear();
+		for (size_t j = i; j < shots.size() && (int)batch.size() < o.in_flight; ++j) {
+			Slot *s;
+			if (!free_slots.pop(s))
+				break;
+			s->shot = shots[j].second;
+			s->image.buf = s->buf.data();
+			s->image.buf_size = s->buf.size();
+			s->image.iter = s->iter.data();
+			s->image.r2 = s->r2.data();
+			s->image.distance = s->distance.empty() ? nullptr : s->distance.data();
+			s->image.width = o.width * s->shot.scale;
+			s->image.height = o.height * s->shot.scale;
+			batch.push_back(s);
+			images.push_back(s->image);
+			rects.push_back(shots[j].first);
+		}
+		// the slots were closed
+		if (batch.empty())
+			break;
+		const double t0 = Profiler::get();
+		render_frames(images.data(), rects.data(), (int)images.size(), o.iterations, perturbed, workers,
+		              o.nthreads, nullptr, o.formula);
+		for (Slot *s : batch) {
+			s->render_time = (Profiler::get() - t0) / batch.size();
+			ready.push(s);
+		}
+	}
+	ready.close();
+	writer.join();
+
+	const double time = Profiler::get() - begin;
+	fprintf(stderr, "%d frames from %zu shots in %.3fs, %.2f frames/s\n", written, shots.size(), time, written / time);
+	if (failed)
+		fprintf(stderr, "writing the frames failed\n");
+	return failed ? 1 : 0;
+}
+
+static bool parse_int(const char *s, int lo, int hi, int &v)
+{
+	char *end;
+	long a = strtol(s, &end, 10);
+	if (!*s || *end || a < lo || a > hi)
+		return false;
+	v = (int)a;
+	return true;
+}
+
+static void usage()
+{
+	fprintf(stderr,
+	        "usage: fractal_zoom [options] keyframes output\n"
+	        "renders the zoom through the keyframes, one \"x0 x1 y0 y1\" per line. output is a printf pattern\n"
+	        "of the frame files like frame%%05d.png, - streams raw 8 bit RGB frames to stdout.\n"
+	        "  -s WxH         frame size, 1280x720\n"
+	        "  -p precision   single, double, ... perturbation as in the job files, double\n"
+	        "  -n iterations  1024\n"
+	        "  -c coloring    bands, smooth, histogram or distance, smooth\n"
+	        "  -F formula     mandelbrot, julia[:cx,cy], burning-ship or multibrot[:degree], mandelbrot\n"
+	        "  -f frames      frames per halving of the view, 30\n"
+	        "  -k shots       shots rendered at once, 2\n"
+	        "  -t threads     render threads\n");
+}
+
+#if LARGE_NUMBERS
+// deep_perturbation() of the deepest keyframe, in the doubled shots near it
+static bool deep_keys(const Options &o, const vector<array<string, 4>> &text)
+{
+	for (const auto &k : text) {
+		string s[4];
+		if (!plain_decimal(k[0], s[0]) || !plain_decimal(k[1], s[1]))
+			continue;
+		const fixed256 x0 = from_decimal<fixed256>(s[0]), x1 = from_decimal<fixed256>(s[1]);
+		const double spacing = fabs(e<double>(x1 - x0)) / (2 * o.width);
+		double magnitude = max(fabs(e<double>(x0)), fabs(e<double>(x1)));
+		for (int i = 2; i < 4; ++i)
+			magnitude = max(magnitude, fabs(strtod(k[i].c_str(), nullptr)));
+		if (deep_perturbation(spacing, magnitude))
+			return true;
+	}
+	return false;
+}
+#endif
+
+int main(int argc, char **argv)
+{
+	Options o;
+	vector<const char *> args;
+	for (int i = 1; i < argc; ++i) {
+		const char *a = argv[i];
+		const char *v = i + 1 < argc ? argv[i + 1] : "";
+		bool ok = true;
+		if (a[0] != '-' || !a[1]) {
+			args.push_back(a);
+			continue;
+		} else if (!strcmp(a, "-s")) {
+			ok = sscanf(v, "%dx%d", &o.width, &o.height) == 2 && o.width > 0 && o.height > 0;
+		} else if (!strcmp(a, "-p")) {
+			ok = parse_precision(v, o.precision);
+		} else if (!strcmp(a, "-n")) {
+			ok = parse_int(v, 1, 1 << 30, o.iterations);
+		} else if (!strcmp(a, "-c")) {
+			const char *names[] = {"bands", "smooth", "histogram", "distance"};
+			int c = -1;
+			for (int k = 0; k < 4; ++k)
+				if (!strcmp(v, names[k]))
+					c = k;
+			ok = c >= 0;
+			o.coloring = static_cast<Coloring>(c);
+		} else if (!strcmp(a, "-F")) {
+			ok = parse_formula(v, o.formula);
+		} else if (!strcmp(a, "-f")) {
+			ok = parse_int(v, 1, 10000, o.frames_per_doubling);
+		} else if (!strcmp(a, "-k")) {
+			ok = parse_int(v, 1, 64, o.in_flight);
+		} else if (!strcmp(a, "-t")) {
+			ok = parse_int(v, 1, 1024, o.nthreads);
+		} else {
+			ok = false;
+		}
+		if (!ok) {
+			usage();
+			return 2;
+		}
+		i++;
+	}
+	if (args.size() != 2) {
+		usage();
+		return 2;
+	}
+	o.output = args[1];
+
+	ifstream file(args[0]);
+	if (!file) {
+		fprintf(stderr, "can't open %s\n", args[0]);
+		return 1;
+	}
+	vector<array<string, 4>> keys;
+	string line;
+	while (getline(file, line)) {
+		size_t first = line.find_first_not_of(" \t\r");
+		if (first == string::npos || line[first] == '#')
+			continue;
+		istringstream in(line);
+		array<string, 4> k;
+		if (!(in >> k[0] >> k[1] >> k[2] >> k[3])) {
+			fprintf(stderr, "bad keyframe: %s\n", line.c_str());
+			return 1;
+		}
+		keys.push_back(k);
+	}
+	if (keys.empty()) {
+		fprintf(stderr, "no keyframes\n");
+		return 1;
+	}
+
+	switch (o.precision) {
+	case Precision::Single:
+		return animate<float>(o, keys, false);
+	case Precision::Double:
+		return animate<double>(o, keys, false);
+#if LARGE_NUMBERS
+	case Precision::Large:
+		return animate<float128>(o, keys, false);
+	case Precision::Fixed128:
+		return animate<fixed128>(o, keys, false);
+	case Precision::Fixed192:
+		return animate<fixed192>(o, keys, false);
+	case Precision::Fixed256:
+		return animate<fixed256>(o, keys, false);
+	case Precision::DoubleDouble:
+		return animate<dd_real>(o, keys, false);
+	case Precision::QuadDouble:
+		return animate<qd_real>(o, keys, false);
+	case Precision::Perturbation:
+		if (deep_keys(o, keys))
+			return animate<fixed256>(o, keys, true);
+		return animate<float128>(o, keys, true);
+#endif
+	}
+	return 1;
+}